@@ -25,6 +25,7 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/spinlock.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,20 +34,39 @@
 #define CONFIG_LOGCAT_SIZE 256
 #endif
 
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/*
+ * Values of logger_entry.hdr_size for entries readers must not see: the
+ * writer has reserved the space but is still copying the payload in, or
+ * the copy failed and the entry is to be skipped.
+ */
+#define LOGGER_ENTRY_PENDING	0
+#define LOGGER_ENTRY_DISCARDED	1
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. The offsets and the readers list
+ * are protected by the spinlock 'lock'.
+ *
+ * Writers reserve space at 'w_resv' under the lock, then copy their entry in
+ * without it, so several writers can be copying at once. Entries between
+ * 'w_off' and 'w_resv' are in flight; 'w_off' only moves over them, in
+ * reservation order, once their writers are done.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
+	wait_queue_head_t	w_wq;	/* wait queue for writers out of room */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct mutex		mutex;	/* serializes readers */
+	spinlock_t		lock;	/* protects offsets and readers */
 	size_t			w_off;	/* current write head offset */
+	size_t			w_resv;	/* next reservation offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
 };
@@ -55,7 +75,8 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. 'r_off' is protected by log->lock, 'buf' by
+ * log->mutex.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
@@ -63,6 +84,7 @@ struct logger_reader {
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	unsigned char		buf[LOGGER_ENTRY_MAX_LEN]; /* entry being read */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -124,7 +146,7 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * In the log, the length does not include the size of the log entry structure.
  * This function returns the size including the log entry structure.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -168,63 +190,75 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * copy_entry_to_buffer - copies the entry at the reader's offset, with a
+ * payload of 'count' bytes, into reader->buf and moves the reader past it.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock and log->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void copy_entry_to_buffer(struct logger_log *log,
+				 struct logger_reader *reader,
+				 size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t off = reader->r_off;
 	size_t len;
-	size_t msg_start;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
-
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	count += sizeof(struct logger_entry);
 
 	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
+	 * We read the entry in two disjoint operations. First, we read from
+	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+	len = min(count, log->size - off);
+	memcpy(reader->buf, log->buffer + off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(reader->buf + len, log->buffer, count - len);
+
+	reader->r_off = logger_offset(log, off + count);
+}
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+/*
+ * do_read_log_to_user - copies the entry in reader->buf, with a payload of
+ * exactly 'count' bytes, into the user-space buffer 'buf'. Returns the
+ * number of bytes copied on success.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t do_read_log_to_user(struct logger_reader *reader,
+				   char __user *buf,
+				   size_t count)
+{
+	struct logger_entry *entry = (struct logger_entry *) reader->buf;
+
+	/*
+	 * First, copy the header to userspace, using the version of
+	 * the header requested
+	 */
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
+
+	buf += get_user_hdr_len(reader->r_ver);
+	if (copy_to_user(buf, entry->msg, count))
+		return -EFAULT;
 
 	return count + get_user_hdr_len(reader->r_ver);
 }
 
 /*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
+ * get_next_readable_entry - Starting at 'off', returns an offset into
+ * 'log->buffer' which contains the first entry 'reader' may read: discarded
+ * entries are skipped and, unless the reader can read all entries, so are
+ * those not written by 'euid'.
+ *
+ * Caller must hold log->lock.
  */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static size_t get_next_readable_entry(struct logger_log *log,
+		struct logger_reader *reader, size_t off, uid_t euid)
 {
 	while (off != log->w_off) {
 		struct logger_entry *entry;
@@ -233,7 +267,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 
 		entry = get_entry_header(log, off, &scratch);
 
-		if (entry->euid == euid)
+		if (entry->hdr_size != LOGGER_ENTRY_DISCARDED &&
+		    (reader->r_all || entry->euid == euid))
 			return off;
 
 		next_len = sizeof(struct logger_entry) + entry->len;
@@ -260,17 +295,18 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -292,27 +328,34 @@ start:
 		return ret;
 
 	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+	reader->r_off = get_next_readable_entry(log, reader,
+		reader->r_off, current_euid());
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
-	if (count < ret) {
+	len = get_entry_msg_len(log, reader->r_off);
+	if (count < get_user_hdr_len(reader->r_ver) + len) {
+		spin_unlock(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/*
+	 * Take exactly one entry out of the log, so that writers lapping
+	 * us cannot change it under the copy to user-space.
+	 */
+	copy_entry_to_buffer(log, reader, len);
+	spin_unlock(&log->lock);
+
+	ret = do_read_log_to_user(reader, buf, len);
 
 out:
 	mutex_unlock(&log->mutex);
@@ -324,7 +367,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -373,13 +416,13 @@ static inline int is_between(size_t a, size_t b, size_t c)
  * fix_up_readers - walk the list of all readers and "fix up" any who were
  * lapped by the writer; also do the same for the default "start head".
  * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * entry after the new reservation head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
-	size_t old = log->w_off;
+	size_t old = log->w_resv;
 	size_t new = logger_offset(log, old + len);
 	struct logger_reader *reader;
 
@@ -392,68 +435,98 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_has_room - can a 'len' byte entry be reserved without lapping
+ * entries that are still in flight?
+ *
+ * Readers being fixed up walk up to one entry past the new reservation,
+ * so keep that much of committed log between the two.
+ */
+static inline bool logger_has_room(struct logger_log *log, size_t len)
+{
+	size_t in_flight = logger_offset(log, log->w_resv - log->w_off);
+
+	return in_flight + len + LOGGER_ENTRY_MAX_LEN <= log->size;
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at offset 'off'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to own the reservation covering the bytes written.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t off,
+			 const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to own the reservation covering the bytes written.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
-			/*
-			 * Note that by not updating w_off, this abandons the
-			 * portion of the new entry that *was* successfully
-			 * copied, just above.  This is intentional to avoid
-			 * message corruption from missing fragments.
-			 */
 			return -EFAULT;
 
-	log->w_off = logger_offset(log, log->w_off + count);
-
 	return count;
 }
 
+/*
+ * logger_commit - moves the write head past every entry whose writer is
+ * done with it, stopping at the first one still being written, so that
+ * readers see entries whole and in reservation order.
+ *
+ * The caller needs to hold log->lock.
+ */
+static void logger_commit(struct logger_log *log)
+{
+	while (log->w_off != log->w_resv) {
+		struct logger_entry scratch;
+		struct logger_entry *entry;
+
+		entry = get_entry_header(log, log->w_off, &scratch);
+		if (entry->hdr_size == LOGGER_ENTRY_PENDING)
+			break;
+
+		log->w_off = logger_offset(log, log->w_off +
+			sizeof(struct logger_entry) + entry->len);
+	}
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Only the reservation of space for the entry is done under log->lock; the
+ * payload is copied in from user-space without it.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t entry_len;
+	size_t off;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -464,23 +537,38 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
-	header.hdr_size = sizeof(struct logger_entry);
+	header.hdr_size = LOGGER_ENTRY_PENDING;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	entry_len = sizeof(struct logger_entry) + header.len;
+
+	spin_lock(&log->lock);
+
+	/*
+	 * Only possible if writers stall in copy_from_user() for long
+	 * enough for the others to go round the whole log.
+	 */
+	while (unlikely(!logger_has_room(log, entry_len))) {
+		spin_unlock(&log->lock);
+		wait_event(log->w_wq, logger_has_room(log, entry_len));
+		spin_lock(&log->lock);
+	}
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * entry after (what will be) the new reservation offset. We do this
+	 * now because the payload is copied in after we drop the lock.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	fix_up_readers(log, entry_len);
+
+	off = log->w_resv;
+	log->w_resv = logger_offset(log, off + entry_len);
+	do_write_log(log, off, &header, sizeof(struct logger_entry));
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -490,20 +578,40 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, logger_offset(log,
+			off + sizeof(struct logger_entry) + ret),
+			iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			ret = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	/*
+	 * Others may have reserved space after us, so a partially copied
+	 * entry cannot be abandoned by winding the write head back. It is
+	 * marked as discarded instead, and readers skip it.
+	 */
+	if (likely(ret >= 0))
+		header.hdr_size = sizeof(struct logger_entry);
+	else
+		header.hdr_size = LOGGER_ENTRY_DISCARDED;
+
+	spin_lock(&log->lock);
+	do_write_log(log, off, &header, sizeof(struct logger_entry));
+	logger_commit(log);
+	spin_unlock(&log->lock);
+
+	if (unlikely(waitqueue_active(&log->w_wq)))
+		wake_up(&log->w_wq);
 
-	/* wake up any blocked readers */
+	/*
+	 * wake up any blocked readers, even on failure: entries reserved
+	 * after ours may only have become readable now
+	 */
 	wake_up_interruptible(&log->wq);
 
 	return ret;
@@ -543,10 +651,10 @@ static int logger_open(struct inode *inode, struct file *file)
 
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -566,9 +674,9 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		kfree(reader);
 	}
@@ -599,14 +707,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+	spin_lock(&log->lock);
+	reader->r_off = get_next_readable_entry(log, reader,
+		reader->r_off, current_euid());
 
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -631,7 +738,21 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	/*
+	 * This one copies from user-space, so can't be under log->lock.
+	 * log->mutex keeps the version stable across a logger_read().
+	 */
+	if (cmd == LOGGER_SET_VERSION) {
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		reader = file->private_data;
+		mutex_lock(&log->mutex);
+		ret = logger_set_version(reader, argp);
+		mutex_unlock(&log->mutex);
+		return ret;
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -655,9 +776,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
+		reader->r_off = get_next_readable_entry(log, reader,
+			reader->r_off, current_euid());
 
 		if (log->w_off != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
@@ -683,17 +803,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
-	case LOGGER_SET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
-			ret = -EBADF;
-			break;
-		}
-		reader = file->private_data;
-		ret = logger_set_version(reader, argp);
-		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -725,9 +837,12 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
+	.w_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .w_wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.w_resv = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
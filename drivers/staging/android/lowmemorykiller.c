@@ -371,6 +371,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct oom_adj_iter iter;
 	int rem = 0;
 	int tasksize;
 	int i;
@@ -439,7 +440,14 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	selected_oom_score_adj = min_score_adj;
 
 	rcu_read_lock();
-	for_each_process(tsk) {
+	/*
+	 * Walk down from the highest oom_score_adj bucket, stopping after the
+	 * first bucket in which a victim has been selected.  Tasks may move
+	 * between buckets during the walk, so their oom_score_adj is still
+	 * checked below.
+	 */
+	for (tsk = oom_adj_iter_first(&iter, min_score_adj); tsk;
+	     tsk = oom_adj_iter_next(&iter, selected != NULL)) {
 		struct task_struct *p;
 		int oom_score_adj;
 
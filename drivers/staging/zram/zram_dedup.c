@@ -0,0 +1,197 @@
+/*
+ * Deduplication of identical pages for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+#include "zram_dedup.h"
+
+/* One hash bucket for every 2^ZRAM_HASH_SHIFT pages of the disk */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 10)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+static u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((const u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_dedup_hash(struct zram_meta *meta,
+				u32 checksum)
+{
+	return &meta->hash[checksum % meta->hash_size];
+}
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+				u32 checksum)
+{
+	struct zram_hash *hash;
+	struct rb_root *rb_root;
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	if (!zram->use_dedup)
+		return;
+
+	new->checksum = checksum;
+	hash = zram_dedup_hash(zram->meta, checksum);
+	rb_root = &hash->rb_root;
+
+	spin_lock(&hash->lock);
+	rb_node = &rb_root->rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, rb_root);
+	spin_unlock(&hash->lock);
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zcomp_strm *zstrm,
+				struct zram_entry *entry, unsigned char *mem)
+{
+	bool match = false;
+	unsigned char *cmem;
+	struct zram_meta *meta = zram->meta;
+
+	cmem = zs_map_object(meta->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE) {
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	} else {
+		/* the stream buffer is free until this page is compressed */
+		if (!zcomp_decompress(zram->comp, cmem, entry->len,
+					zstrm->buffer))
+			match = !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+	}
+	zs_unmap_object(meta->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for an entry holding the same data as @mem. On success a
+ * reference is taken on the returned entry on behalf of the caller.
+ * The checksum of @mem is returned in @checksum either way, so that
+ * the caller can insert a freshly compressed entry.
+ *
+ * The candidate is compared under the bucket lock so that it cannot
+ * go away meanwhile. Only the first entry with a matching checksum is
+ * compared; on a 32bit checksum collision the page is simply stored
+ * again.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, struct zcomp_strm *zstrm,
+				unsigned char *mem, u32 *checksum)
+{
+	struct zram_hash *hash;
+	struct zram_entry *entry;
+	struct rb_node *rb_node;
+
+	if (!zram->use_dedup)
+		return NULL;
+
+	*checksum = zram_dedup_checksum(mem);
+	hash = zram_dedup_hash(zram->meta, *checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (*checksum == entry->checksum) {
+			if (!zram_dedup_match(zram, zstrm, entry, mem))
+				break;
+
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+
+			atomic64_add(entry->len, &zram->stats.dup_data_size);
+			atomic64_inc(&zram->stats.pages_dup);
+			return entry;
+		}
+
+		if (*checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+void zram_dedup_init_entry(struct zram_entry *entry)
+{
+	entry->refcount = 1;
+	entry->checksum = 0;
+	RB_CLEAR_NODE(&entry->rb_node);
+}
+
+/*
+ * Drop one reference. Returns true when it was the last one and the
+ * entry has been unlinked, so the caller must free its memory.
+ */
+bool zram_dedup_put_entry(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+
+	if (RB_EMPTY_NODE(&entry->rb_node))
+		return true;
+
+	hash = zram_dedup_hash(zram->meta, entry->checksum);
+
+	spin_lock(&hash->lock);
+	entry->refcount--;
+	if (!entry->refcount) {
+		rb_erase(&entry->rb_node, &hash->rb_root);
+		RB_CLEAR_NODE(&entry->rb_node);
+		spin_unlock(&hash->lock);
+		return true;
+	}
+	spin_unlock(&hash->lock);
+
+	atomic64_sub(entry->len, &zram->stats.dup_data_size);
+	atomic64_dec(&zram->stats.pages_dup);
+	return false;
+}
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages)
+{
+	int i;
+	struct zram_hash *hash;
+
+	meta->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	meta->hash_size = min_t(size_t, ZRAM_HASH_SIZE_MAX, meta->hash_size);
+	meta->hash_size = max_t(size_t, ZRAM_HASH_SIZE_MIN, meta->hash_size);
+	meta->hash = vzalloc(meta->hash_size * sizeof(struct zram_hash));
+	if (!meta->hash)
+		return -ENOMEM;
+
+	for (i = 0; i < meta->hash_size; i++) {
+		hash = &meta->hash[i];
+		spin_lock_init(&hash->lock);
+		hash->rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram_meta *meta)
+{
+	vfree(meta->hash);
+	meta->hash = NULL;
+}
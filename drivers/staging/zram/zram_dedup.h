@@ -0,0 +1,44 @@
+/*
+ * Deduplication of identical pages for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+struct zram;
+struct zram_meta;
+struct zram_entry;
+struct zcomp_strm;
+
+#ifdef CONFIG_ZRAM_DEDUP
+/* one rbtree of entries, ordered by checksum, per hash bucket */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+				u32 checksum);
+struct zram_entry *zram_dedup_find(struct zram *zram, struct zcomp_strm *zstrm,
+				unsigned char *mem, u32 *checksum);
+
+void zram_dedup_init_entry(struct zram_entry *entry);
+bool zram_dedup_put_entry(struct zram *zram, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages);
+void zram_dedup_fini(struct zram_meta *meta);
+#else
+
+static inline int zram_dedup_init(struct zram_meta *meta,
+		size_t num_pages) { return 0; }
+static inline void zram_dedup_fini(struct zram_meta *meta) { }
+
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
@@ -29,16 +29,22 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/bit_spinlock.h>
+#include <linux/file.h>
+#include <linux/workqueue.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/ratelimit.h>
 
 #include "zram_drv.h"
+#include "zram_dedup.h"
 
 /* Globals */
 static int zram_major;
 static struct zram *zram_devices;
+#ifdef CONFIG_ZRAM_DEDUP
+static struct kmem_cache *zram_entry_cache;
+#endif
 
 /*
  * We don't need to see memory allocation errors more than once every 1
@@ -46,6 +52,8 @@ static struct zram *zram_devices;
  */
 #define ALLOC_ERROR_LOG_RATE_MS 1000
 
+static const char *default_compressor = "lzo";
+
 /* Module params (documentation at end) */
 static unsigned int num_devices = 1;
 
@@ -111,8 +119,72 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.pages_zero));
+}
+
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.pages_same));
+}
+
+static ssize_t dup_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.dup_data_size));
+}
+
+static ssize_t dup_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.pages_dup));
+}
+
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%d\n", val);
+}
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtoint(buf, 10, &val) || (val != 0 && val != 1))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+
+	return len;
 }
+#endif
 
 static ssize_t orig_data_size_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
@@ -120,7 +192,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic64_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -147,23 +219,554 @@ static ssize_t mem_used_total_show(struct device *dev,
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+	zs_compact(zram->meta->mem_pool);
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned long val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	if (zram->init_done)
+		val = zs_get_pages_compacted(zram->meta->mem_pool);
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%lu\n", val);
+}
+
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->max_comp_streams;
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%d\n", val);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int num;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtoint(buf, 0, &num))
+		return -EINVAL;
+	if (num < 1)
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		up_write(&zram->init_lock);
+		pr_info("Can't set max_comp_streams for initialized device\n");
+		return -EBUSY;
+	}
+	zram->max_comp_streams = num;
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->compressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[sizeof(zram->compressor)];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	if (!zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+	strlcpy(zram->compressor, compressor, sizeof(compressor));
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
+/* flag operations need meta->table[index].value's ZRAM_ACCESS bit held */
 static int zram_test_flag(struct zram_meta *meta, u32 index,
 			enum zram_pageflags flag)
 {
-	return meta->table[index].flags & BIT(flag);
+	return meta->table[index].value & BIT(flag);
+}
+
+static void zram_set_flag(struct zram_meta *meta, u32 index,
+			enum zram_pageflags flag)
+{
+	meta->table[index].value |= BIT(flag);
+}
+
+static void zram_clear_flag(struct zram_meta *meta, u32 index,
+			enum zram_pageflags flag)
+{
+	meta->table[index].value &= ~BIT(flag);
+}
+
+static size_t zram_get_obj_size(struct zram_meta *meta, u32 index)
+{
+	return meta->table[index].value & (BIT(ZRAM_FLAG_SHIFT) - 1);
+}
+
+static void zram_set_obj_size(struct zram_meta *meta,
+					u32 index, size_t size)
+{
+	unsigned long flags = meta->table[index].value >> ZRAM_FLAG_SHIFT;
+
+	meta->table[index].value = (flags << ZRAM_FLAG_SHIFT) | size;
+}
+
+static void zram_lock_table(struct zram_meta *meta, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+}
+
+static void zram_unlock_table(struct zram_meta *meta, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static inline bool zram_wb_enabled(struct zram *zram)
+{
+	return zram->backing_dev;
+}
+
+static void reset_bdev(struct zram *zram)
+{
+	struct block_device *bdev;
+
+	if (!zram_wb_enabled(zram))
+		return;
+
+	bdev = zram->bdev;
+	/* restore the block size while we still hold the device */
+	set_blocksize(bdev, zram->old_block_size);
+	/* hope filp_close flush all of IO */
+	blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	zram->backing_dev = NULL;
+	zram->old_block_size = 0;
+	zram->bdev = NULL;
+
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *file;
+	char *p;
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	file = zram->backing_dev;
+	if (!file) {
+		memcpy(buf, "none\n", 5);
+		up_read(&zram->init_lock);
+		return 5;
+	}
+
+	p = d_path(&file->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char *file_name;
+	size_t sz;
+	struct file *backing_dev = NULL;
+	struct inode *inode;
+	struct address_space *mapping;
+	unsigned int bitmap_sz, old_block_size = 0;
+	unsigned long nr_pages, *bitmap = NULL;
+	struct block_device *bdev = NULL;
+	int err;
+	struct zram *zram = dev_to_zram(dev);
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	backing_dev = filp_open(file_name, O_RDWR|O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		backing_dev = NULL;
+		goto out;
+	}
+
+	mapping = backing_dev->f_mapping;
+	inode = mapping->host;
+
+	/* Support only block device in this moment */
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0) {
+		bdev = NULL;
+		goto out;
+	}
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap_sz = BITS_TO_LONGS(nr_pages) * sizeof(long);
+	bitmap = vzalloc(bitmap_sz);
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	old_block_size = block_size(bdev);
+	err = set_blocksize(bdev, PAGE_SIZE);
+	if (err)
+		goto out;
+
+	reset_bdev(zram);
+
+	zram->old_block_size = old_block_size;
+	zram->bdev = bdev;
+	zram->backing_dev = backing_dev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+
+	return len;
+out:
+	if (bitmap)
+		vfree(bitmap);
+
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+
+	if (backing_dev)
+		filp_close(backing_dev, NULL);
+
+	up_write(&zram->init_lock);
+
+	kfree(file_name);
+
+	return err;
+}
+
+/*
+ * Reserve a block on the backing device, preferring the one right after
+ * @hint so that a writeback batch ends up as few contiguous bios.
+ * Block 0 is never handed out so that it can mean "no block".
+ */
+static unsigned long alloc_block_bdev(struct zram *zram, unsigned long hint)
+{
+	unsigned long blk_idx = hint ? hint : 1;
+
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx >= zram->nr_pages) {
+		if (hint <= 1)
+			return 0;
+		hint = 0;
+		blk_idx = 1;
+		goto retry;
+	}
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic64_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	int was_set;
+
+	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
+	WARN_ON_ONCE(!was_set);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+struct zram_bio_ctx {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+static void zram_bio_ctx_init(struct zram_bio_ctx *ctx)
+{
+	/* the submitter holds one reference until all bios are issued */
+	atomic_set(&ctx->pending, 1);
+	ctx->error = 0;
+	init_completion(&ctx->done);
+}
+
+static void zram_bio_ctx_put(struct zram_bio_ctx *ctx)
+{
+	if (atomic_dec_and_test(&ctx->pending))
+		complete(&ctx->done);
+}
+
+static void zram_bio_end_io(struct bio *bio, int err)
+{
+	struct zram_bio_ctx *ctx = bio->bi_private;
+
+	if (err || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ctx->error = err ? err : -EIO;
+	zram_bio_ctx_put(ctx);
+	bio_put(bio);
+}
+
+/*
+ * Build and submit one bio covering @nr_pages consecutive blocks
+ * starting at @blk_idx.
+ */
+static int zram_submit_bdev_bio(struct zram *zram, int rw,
+		unsigned long blk_idx, struct page **pages, int nr_pages,
+		struct zram_bio_ctx *ctx)
+{
+	struct bio *bio;
+	int i;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk_idx * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bio_end_io;
+	bio->bi_private = ctx;
+	for (i = 0; i < nr_pages; i++) {
+		if (!bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			bio_put(bio);
+			return -EIO;
+		}
+	}
+
+	atomic_inc(&ctx->pending);
+	submit_bio(rw, bio);
+	return 0;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk_idx;
+	struct page *page;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+	struct zram_bio_ctx ctx;
+
+	zram_bio_ctx_init(&ctx);
+	zw->ret = zram_submit_bdev_bio(zw->zram, READ, zw->blk_idx,
+					&zw->page, 1, &ctx);
+	zram_bio_ctx_put(&ctx);
+	wait_for_completion(&ctx.done);
+	if (!zw->ret)
+		zw->ret = ctx.error;
+}
+
+/*
+ * Reads come in from zram's make_request function, where bios submitted
+ * by the current task are only queued until it returns. Issue the read
+ * from a worker so that waiting for it cannot deadlock.
+ */
+static int read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk_idx)
+{
+	struct zram_work work;
+
+	work.zram = zram;
+	work.page = page;
+	work.blk_idx = blk_idx;
+
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+
+	atomic64_inc(&zram->stats.bd_reads);
+	return work.ret;
+}
+
+/* read a written back page into @mem, which must be a kernel address */
+static int zram_read_bdev_page(struct zram *zram, unsigned long blk_idx,
+			void *mem, int offset, int len)
+{
+	struct page *page;
+	void *src;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = read_from_bdev(zram, page, blk_idx);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src + offset, len);
+		kunmap_atomic(src);
+	}
+	__free_page(page);
+	return ret;
+}
+
+/*
+ * Read the written back page of slot @index into @mem. The caller holds
+ * the slot lock and found ZRAM_WB set; the lock is dropped here.
+ *
+ * The block stays pinned across the read: if the slot is freed in the
+ * meantime, zram_free_page() sees ZRAM_BDEV_READ and leaves the block
+ * allocated to us, so it cannot be handed to another writeback and
+ * overwritten under the read. We then release it and return -EAGAIN
+ * for the caller to look at the slot again.
+ */
+static int zram_read_wb_slot(struct zram *zram, u32 index, void *mem,
+			int offset, int len)
+{
+	struct zram_meta *meta = zram->meta;
+	unsigned long blk_idx = meta->table[index].blk_idx;
+	bool freed;
+	int ret;
+
+	if (zram_test_flag(meta, index, ZRAM_BDEV_READ)) {
+		/* one read of a slot at a time, wait for the other one */
+		zram_unlock_table(meta, index);
+		schedule_timeout_uninterruptible(1);
+		return -EAGAIN;
+	}
+	zram_set_flag(meta, index, ZRAM_BDEV_READ);
+	zram_unlock_table(meta, index);
+
+	ret = zram_read_bdev_page(zram, blk_idx, mem, offset, len);
+
+	/* a freed slot cannot get our block back while we still hold it */
+	zram_lock_table(meta, index);
+	freed = !zram_test_flag(meta, index, ZRAM_WB) ||
+		meta->table[index].blk_idx != blk_idx;
+	if (!freed)
+		zram_clear_flag(meta, index, ZRAM_BDEV_READ);
+	zram_unlock_table(meta, index);
+
+	if (freed) {
+		free_block_bdev(zram, blk_idx);
+		return -EAGAIN;
+	}
+	return ret;
+}
+
+static int read_from_bdev_bvec(struct zram *zram, struct bio_vec *bvec,
+			u32 index, int offset)
+{
+	void *user_mem;
+	int ret;
+
+	/* the page can't stay atomically mapped while the read sleeps */
+	user_mem = kmap(bvec->bv_page);
+	ret = zram_read_wb_slot(zram, index, user_mem + bvec->bv_offset,
+				offset, bvec->bv_len);
+	kunmap(bvec->bv_page);
+	if (ret == -EAGAIN)
+		return ret;
+	if (ret)
+		atomic64_inc(&zram->stats.failed_reads);
+	else
+		flush_dcache_page(bvec->bv_page);
+	return ret;
+}
+#else
+static inline bool zram_wb_enabled(struct zram *zram) { return false; }
+static inline void reset_bdev(struct zram *zram) {};
+static inline void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
 }
-
-static void zram_set_flag(struct zram_meta *meta, u32 index,
-			enum zram_pageflags flag)
+static inline int zram_read_wb_slot(struct zram *zram, u32 index,
+			void *mem, int offset, int len)
 {
-	meta->table[index].flags |= BIT(flag);
+	zram_unlock_table(zram->meta, index);
+	return -EIO;
 }
-
-static void zram_clear_flag(struct zram_meta *meta, u32 index,
-			enum zram_pageflags flag)
+static inline int read_from_bdev_bvec(struct zram *zram,
+			struct bio_vec *bvec, u32 index, int offset)
 {
-	meta->table[index].flags &= ~BIT(flag);
+	zram_unlock_table(zram->meta, index);
+	return -EIO;
 }
+#endif
 
 static inline int is_partial_io(struct bio_vec *bvec)
 {
@@ -196,9 +799,8 @@ static inline int valid_io_request(struct zram *zram, struct bio *bio)
 
 static void zram_meta_free(struct zram_meta *meta)
 {
+	zram_dedup_fini(meta);
 	zs_destroy_pool(meta->mem_pool);
-	kfree(meta->compress_workmem);
-	free_pages((unsigned long)meta->compress_buffer, 1);
 	vfree(meta->table);
 	kfree(meta);
 }
@@ -210,22 +812,11 @@ static struct zram_meta *zram_meta_alloc(u64 disksize)
 	if (!meta)
 		goto out;
 
-	meta->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!meta->compress_workmem)
-		goto free_meta;
-
-	meta->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!meta->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		goto free_workmem;
-	}
-
 	num_pages = disksize >> PAGE_SHIFT;
 	meta->table = vzalloc(num_pages * sizeof(*meta->table));
 	if (!meta->table) {
 		pr_err("Error allocating zram address table\n");
-		goto free_buffer;
+		goto free_meta;
 	}
 
 	meta->mem_pool = zs_create_pool(GFP_NOIO | __GFP_HIGHMEM |
@@ -235,14 +826,17 @@ static struct zram_meta *zram_meta_alloc(u64 disksize)
 		goto free_table;
 	}
 
+	if (zram_dedup_init(meta, num_pages)) {
+		pr_err("Error allocating dedup hash table\n");
+		goto free_pool;
+	}
+
 	return meta;
 
+free_pool:
+	zs_destroy_pool(meta->mem_pool);
 free_table:
 	vfree(meta->table);
-free_buffer:
-	free_pages((unsigned long)meta->compress_buffer, 1);
-free_workmem:
-	kfree(meta->compress_workmem);
 free_meta:
 	kfree(meta);
 	meta = NULL;
@@ -257,92 +851,292 @@ static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Check whether the page consists of a single repeated machine word.
+ * The last word is tested first so that ordinary data bails out early.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
-	unsigned int pos;
+	unsigned int pos, last_pos = PAGE_SIZE / sizeof(unsigned long) - 1;
 	unsigned long *page;
+	unsigned long val;
 
 	page = (unsigned long *)ptr;
+	val = page[0];
+
+	if (val != page[last_pos])
+		return 0;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos < last_pos; pos++) {
+		if (val != page[pos])
 			return 0;
 	}
 
+	*element = val;
 	return 1;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void zram_fill_page(void *ptr, unsigned long len,
+			   unsigned long value)
+{
+	unsigned long *page = ptr;
+	unsigned long i, nr = len / sizeof(*page);
+
+	WARN_ON_ONCE(!IS_ALIGNED(len, sizeof(unsigned long)));
+
+	if (likely(value == 0)) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	/* unrolled so that the stores can be combined by the compiler */
+	for (i = 0; i + 4 <= nr; i += 4) {
+		page[i] = value;
+		page[i + 1] = value;
+		page[i + 2] = value;
+		page[i + 3] = value;
+	}
+	for (; i < nr; i++)
+		page[i] = value;
+}
+
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	if (is_partial_io(bvec))
-		memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
-	else
-		clear_page(user_mem);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
 }
 
+#ifdef CONFIG_ZRAM_DEDUP
+#define ZRAM_NO_OBJ	((struct zram_obj) { .entry = NULL })
+
+static inline bool zram_obj_empty(struct zram_obj obj)
+{
+	return !obj.entry;
+}
+
+static inline unsigned long zram_obj_handle(struct zram_obj obj)
+{
+	return obj.entry->handle;
+}
+
+static struct zram_obj zram_obj_alloc(struct zram *zram,
+					size_t len, gfp_t flags)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, flags);
+	if (!entry)
+		return ZRAM_NO_OBJ;
+
+	entry->handle = zs_malloc(meta->mem_pool, len);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return ZRAM_NO_OBJ;
+	}
+
+	entry->len = len;
+	zram_dedup_init_entry(entry);
+	return (struct zram_obj) { .entry = entry };
+}
+
+/*
+ * Drop a reference to @obj and release its memory once the last
+ * table slot pointing at it is gone. Returns true if it was released.
+ */
+static bool zram_obj_free(struct zram *zram, struct zram_obj obj)
+{
+	struct zram_entry *entry = obj.entry;
+
+	if (!zram_dedup_put_entry(zram, entry))
+		return false;
+
+	zs_free(zram->meta->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+	return true;
+}
+
+/*
+ * Look for a stored object with the same contents as @mem. A hit comes
+ * back with a reference taken for the caller and its length in @len.
+ */
+static struct zram_obj zram_obj_find_dup(struct zram *zram,
+		struct zcomp_strm *zstrm, unsigned char *mem, u32 *checksum,
+		size_t *len)
+{
+	struct zram_entry *entry;
+
+	entry = zram_dedup_find(zram, zstrm, mem, checksum);
+	if (!entry)
+		return ZRAM_NO_OBJ;
+
+	*len = entry->len;
+	return (struct zram_obj) { .entry = entry };
+}
+
+static void zram_obj_insert_dup(struct zram *zram, struct zram_obj obj,
+				u32 checksum)
+{
+	zram_dedup_insert(zram, obj.entry, checksum);
+}
+
+static int __init zram_entry_cache_create(void)
+{
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	return zram_entry_cache ? 0 : -ENOMEM;
+}
+
+static void zram_entry_cache_destroy(void)
+{
+	kmem_cache_destroy(zram_entry_cache);
+}
+#else
+#define ZRAM_NO_OBJ	((struct zram_obj) { .handle = 0 })
+
+static inline bool zram_obj_empty(struct zram_obj obj)
+{
+	return !obj.handle;
+}
+
+static inline unsigned long zram_obj_handle(struct zram_obj obj)
+{
+	return obj.handle;
+}
+
+static inline struct zram_obj zram_obj_alloc(struct zram *zram,
+					size_t len, gfp_t flags)
+{
+	return (struct zram_obj) { .handle = zs_malloc(zram->meta->mem_pool,
+						       len) };
+}
+
+static inline bool zram_obj_free(struct zram *zram, struct zram_obj obj)
+{
+	zs_free(zram->meta->mem_pool, obj.handle);
+	return true;
+}
+
+static inline struct zram_obj zram_obj_find_dup(struct zram *zram,
+		struct zcomp_strm *zstrm, unsigned char *mem, u32 *checksum,
+		size_t *len)
+{
+	*checksum = 0;
+	return ZRAM_NO_OBJ;
+}
+
+static inline void zram_obj_insert_dup(struct zram *zram,
+				struct zram_obj obj, u32 checksum) { }
+
+static inline int zram_entry_cache_create(void) { return 0; }
+static inline void zram_entry_cache_destroy(void) { }
+#endif
+
+/*
+ * To protect concurrent access to the same index entry,
+ * caller should hold this table index entry's bit_spinlock to
+ * indicate this index entry is accessing.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	struct zram_meta *meta = zram->meta;
-	unsigned long handle = meta->table[index].handle;
-	u16 size = meta->table[index].size;
+	struct zram_obj obj = meta->table[index].obj;
+	size_t size = zram_get_obj_size(meta, index);
+
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	/* let a running writeback know that the slot changed under it */
+	zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		/* a reader still uses the block and frees it when done */
+		if (zram_test_flag(meta, index, ZRAM_BDEV_READ))
+			zram_clear_flag(meta, index, ZRAM_BDEV_READ);
+		else
+			free_block_bdev(zram, meta->table[index].blk_idx);
+		meta->table[index].blk_idx = 0;
+		return;
+	}
 
-	if (unlikely(!handle)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(meta, index, ZRAM_ZERO)) {
-			zram_clear_flag(meta, index, ZRAM_ZERO);
-			zram->stats.pages_zero--;
-		}
+	/*
+	 * No memory is allocated for same element filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(meta, index, ZRAM_SAME)) {
+		zram_clear_flag(meta, index, ZRAM_SAME);
+		if (meta->table[index].element)
+			atomic64_dec(&zram->stats.pages_same);
+		else
+			atomic64_dec(&zram->stats.pages_zero);
+		meta->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(zram_obj_empty(obj)))
+		return;
+
 	if (unlikely(size > max_zpage_size))
-		zram->stats.bad_compress--;
+		atomic64_dec(&zram->stats.bad_compress);
 
-	zs_free(meta->mem_pool, handle);
+	/* a shared entry only accounts its memory once */
+	if (zram_obj_free(zram, obj))
+		atomic64_sub(size, &zram->stats.compr_size);
 
 	if (size <= PAGE_SIZE / 2)
-		zram->stats.good_compress--;
+		atomic64_dec(&zram->stats.good_compress);
 
-	atomic64_sub(meta->table[index].size, &zram->stats.compr_size);
-	zram->stats.pages_stored--;
+	atomic64_dec(&zram->stats.pages_stored);
 
-	meta->table[index].handle = 0;
-	meta->table[index].size = 0;
+	meta->table[index].obj = ZRAM_NO_OBJ;
+	zram_set_obj_size(meta, index, 0);
 }
 
 static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 {
-	int ret = LZO_E_OK;
-	size_t clen = PAGE_SIZE;
+	int ret = 0;
 	unsigned char *cmem;
 	struct zram_meta *meta = zram->meta;
-	unsigned long handle = meta->table[index].handle;
+	struct zram_obj obj;
+	size_t size;
+
+retry:
+	zram_lock_table(meta, index);
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		ret = zram_read_wb_slot(zram, index, mem, 0, PAGE_SIZE);
+		if (ret == -EAGAIN)
+			goto retry;
+		return ret;
+	}
 
-	if (!handle || zram_test_flag(meta, index, ZRAM_ZERO)) {
-		clear_page(mem);
+	obj = meta->table[index].obj;
+	size = zram_get_obj_size(meta, index);
+
+	if (zram_obj_empty(obj) || zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long element = 0;
+
+		if (zram_test_flag(meta, index, ZRAM_SAME))
+			element = meta->table[index].element;
+		zram_unlock_table(meta, index);
+		zram_fill_page(mem, PAGE_SIZE, element);
 		return 0;
 	}
 
-	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_RO);
-	if (meta->table[index].size == PAGE_SIZE)
+	cmem = zs_map_object(meta->mem_pool, zram_obj_handle(obj), ZS_MM_RO);
+	if (size == PAGE_SIZE)
 		copy_page(mem, cmem);
 	else
-		ret = lzo1x_decompress_safe(cmem, meta->table[index].size,
-						mem, &clen);
-	zs_unmap_object(meta->mem_pool, handle);
+		ret = zcomp_decompress(zram->comp, cmem, size, mem);
+	zs_unmap_object(meta->mem_pool, zram_obj_handle(obj));
+	zram_unlock_table(meta, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		atomic64_inc(&zram->stats.failed_reads);
 		return ret;
@@ -360,17 +1154,37 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	struct zram_meta *meta = zram->meta;
 	page = bvec->bv_page;
 
-	if (unlikely(!meta->table[index].handle) ||
-			zram_test_flag(meta, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+retry:
+	zram_lock_table(meta, index);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		ret = read_from_bdev_bvec(zram, bvec, index, offset);
+		if (ret == -EAGAIN)
+			goto retry;
+		return ret;
+	}
+
+	if (unlikely(zram_obj_empty(meta->table[index].obj)) ||
+			zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long element = 0;
+
+		if (zram_test_flag(meta, index, ZRAM_SAME))
+			element = meta->table[index].element;
+		zram_unlock_table(meta, index);
+		handle_same_page(bvec, element);
 		return 0;
 	}
+	zram_unlock_table(meta, index);
 
 	if (is_partial_io(bvec))
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 
-	user_mem = kmap_atomic(page);
+	/*
+	 * The slot may be written back once its lock is dropped, and then
+	 * zram_decompress_page() sleeps on the backing device read.
+	 */
+	user_mem = kmap(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
 
@@ -382,7 +1196,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 
 	ret = zram_decompress_page(zram, uncmem, index);
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK))
+	if (unlikely(ret))
 		goto out_cleanup;
 
 	if (is_partial_io(bvec))
@@ -392,7 +1206,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	flush_dcache_page(page);
 	ret = 0;
 out_cleanup:
-	kunmap_atomic(user_mem);
+	kunmap(page);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 	return ret;
@@ -403,14 +1217,16 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 {
 	int ret = 0;
 	size_t clen;
-	unsigned long handle;
+	unsigned long element;
+	u32 checksum;
+	struct zram_obj obj;
 	struct page *page;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 	struct zram_meta *meta = zram->meta;
+	struct zcomp_strm *zstrm = NULL;
 	static unsigned long zram_rs_time;
 
 	page = bvec->bv_page;
-	src = meta->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -427,6 +1243,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 	}
 
+	zstrm = zcomp_strm_find(zram->comp);
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec)) {
@@ -438,27 +1255,34 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		uncmem = user_mem;
 	}
 
-	if (page_zero_filled(uncmem)) {
-		kunmap_atomic(user_mem);
+	if (page_same_filled(uncmem, &element)) {
+		if (user_mem)
+			kunmap_atomic(user_mem);
 		/* Free memory associated with this sector now. */
+		zram_lock_table(meta, index);
 		zram_free_page(zram, index);
-
-		zram->stats.pages_zero++;
-		zram_set_flag(meta, index, ZRAM_ZERO);
+		zram_set_flag(meta, index, ZRAM_SAME);
+		meta->table[index].element = element;
+		zram_unlock_table(meta, index);
+
+		if (element)
+			atomic64_inc(&zram->stats.pages_same);
+		else
+			atomic64_inc(&zram->stats.pages_zero);
 		ret = 0;
 		goto out;
 	}
 
-	/*
-	 * zram_slot_free_notify could miss free so that let's
-	 * double check.
-	 */
-	if (unlikely(meta->table[index].handle ||
-			zram_test_flag(meta, index, ZRAM_ZERO)))
-		zram_free_page(zram, index);
+	obj = zram_obj_find_dup(zram, zstrm, uncmem, &checksum, &clen);
+	if (!zram_obj_empty(obj)) {
+		if (user_mem)
+			kunmap_atomic(user_mem);
+		if (unlikely(clen > max_zpage_size))
+			atomic64_inc(&zram->stats.bad_compress);
+		goto found_dup;
+	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       meta->compress_workmem);
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 
 	if (!is_partial_io(bvec)) {
 		kunmap_atomic(user_mem);
@@ -466,21 +1290,22 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		uncmem = NULL;
 	}
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
 
+	src = zstrm->buffer;
 	if (unlikely(clen > max_zpage_size)) {
-		zram->stats.bad_compress++;
+		atomic64_inc(&zram->stats.bad_compress);
 		clen = PAGE_SIZE;
 		src = NULL;
 		if (is_partial_io(bvec))
 			src = uncmem;
 	}
 
-	handle = zs_malloc(meta->mem_pool, clen);
-	if (!handle) {
+	obj = zram_obj_alloc(zram, clen, GFP_NOIO);
+	if (zram_obj_empty(obj)) {
 		if (printk_timed_ratelimit(&zram_rs_time,
 					   ALLOC_ERROR_LOG_RATE_MS))
 			pr_info("Error allocating memory for compressed page: %u, size=%zu\n",
@@ -488,7 +1313,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = -ENOMEM;
 		goto out;
 	}
-	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_WO);
+	cmem = zs_map_object(meta->mem_pool, zram_obj_handle(obj), ZS_MM_WO);
 
 	if ((clen == PAGE_SIZE) && !is_partial_io(bvec)) {
 		src = kmap_atomic(page);
@@ -498,24 +1323,35 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		memcpy(cmem, src, clen);
 	}
 
-	zs_unmap_object(meta->mem_pool, handle);
+	zcomp_strm_release(zram->comp, zstrm);
+	zstrm = NULL;
+	zs_unmap_object(meta->mem_pool, zram_obj_handle(obj));
 
+	zram_obj_insert_dup(zram, obj, checksum);
+	atomic64_add(clen, &zram->stats.compr_size);
+
+found_dup:
 	/*
 	 * Free memory associated with this sector
 	 * before overwriting unused sectors.
 	 */
+	zram_lock_table(meta, index);
 	zram_free_page(zram, index);
 
-	meta->table[index].handle = handle;
-	meta->table[index].size = clen;
+	meta->table[index].obj = obj;
+	zram_set_obj_size(meta, index, clen);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(meta, index, ZRAM_HUGE);
+	zram_unlock_table(meta, index);
 
 	/* Update stats */
-	atomic64_add(clen, &zram->stats.compr_size);
-	zram->stats.pages_stored++;
+	atomic64_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
-		zram->stats.good_compress++;
+		atomic64_inc(&zram->stats.good_compress);
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 
@@ -524,36 +1360,262 @@ out:
 	return ret;
 }
 
-static void handle_pending_slot_free(struct zram *zram)
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		/*
+		 * Every allocated slot is marked; any later read or write
+		 * clears the mark again.
+		 */
+		zram_lock_table(meta, index);
+		if (!zram_obj_empty(meta->table[index].obj) &&
+				!zram_test_flag(meta, index, ZRAM_SAME) &&
+				!zram_test_flag(meta, index, ZRAM_WB))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		zram_unlock_table(meta, index);
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+#define IDLE_WRITEBACK		(1 << 0)
+#define HUGE_WRITEBACK		(1 << 1)
+
+struct zram_wb_batch {
+	u32 index[ZRAM_WB_BATCH];
+	unsigned long blk_idx[ZRAM_WB_BATCH];
+	struct page *pages[ZRAM_WB_BATCH];
+	int nr;
+};
+
+/*
+ * Write the collected pages out as one plugged run of bios, one bio per
+ * stretch of contiguous blocks, then switch every slot that was not
+ * touched meanwhile over to its block on the backing device.
+ */
+static int zram_wb_flush(struct zram *zram, struct zram_wb_batch *wb)
+{
+	struct zram_meta *meta = zram->meta;
+	struct zram_bio_ctx ctx;
+	struct blk_plug plug;
+	int i, start, ret = 0;
+
+	if (!wb->nr)
+		return 0;
+
+	zram_bio_ctx_init(&ctx);
+	blk_start_plug(&plug);
+	for (start = 0, i = 1; i <= wb->nr; i++) {
+		if (i < wb->nr &&
+		    wb->blk_idx[i] == wb->blk_idx[i - 1] + 1)
+			continue;
+
+		ret = zram_submit_bdev_bio(zram, WRITE, wb->blk_idx[start],
+				&wb->pages[start], i - start, &ctx);
+		if (ret)
+			break;
+		start = i;
+	}
+	blk_finish_plug(&plug);
+	zram_bio_ctx_put(&ctx);
+	wait_for_completion(&ctx.done);
+	if (!ret)
+		ret = ctx.error;
+
+	for (i = 0; i < wb->nr; i++) {
+		u32 index = wb->index[i];
+
+		zram_lock_table(meta, index);
+		/*
+		 * The slot was freed or overwritten while the write was in
+		 * flight (which clears ZRAM_UNDER_WB), or the write failed:
+		 * keep the page in memory and give the block back.
+		 */
+		if (ret || !zram_test_flag(meta, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_unlock_table(meta, index);
+			free_block_bdev(zram, wb->blk_idx[i]);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(meta, index, ZRAM_WB);
+		meta->table[index].blk_idx = wb->blk_idx[i];
+		zram_unlock_table(meta, index);
+		atomic64_inc(&zram->stats.bd_writes);
+	}
+
+	wb->nr = 0;
+	return ret;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
 {
-	struct zram_slot_free *free_rq;
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index, blk_idx = 0;
+	struct zram_wb_batch *wb;
+	int mode, i;
+	ssize_t ret = len;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_WRITEBACK;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_WRITEBACK;
+	else
+		return -EINVAL;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		wb->pages[i] = alloc_page(GFP_KERNEL);
+		if (!wb->pages[i]) {
+			ret = -ENOMEM;
+			goto free_pages;
+		}
+	}
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram_wb_enabled(zram)) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
 
-	spin_lock(&zram->slot_free_lock);
-	while (zram->slot_free_rq) {
-		free_rq = zram->slot_free_rq;
-		zram->slot_free_rq = free_rq->next;
-		zram_free_page(zram, free_rq->index);
-		kfree(free_rq);
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		void *mem;
+		int err;
+
+		zram_lock_table(meta, index);
+		if (zram_obj_empty(meta->table[index].obj) ||
+				zram_test_flag(meta, index, ZRAM_SAME) ||
+				zram_test_flag(meta, index, ZRAM_WB) ||
+				zram_test_flag(meta, index, ZRAM_UNDER_WB))
+			goto next;
+
+		if ((mode & IDLE_WRITEBACK &&
+			  !zram_test_flag(meta, index, ZRAM_IDLE)) ||
+		    (mode & HUGE_WRITEBACK &&
+			  !zram_test_flag(meta, index, ZRAM_HUGE)))
+			goto next;
+
+		/* Need for hugepage writeback racing */
+		zram_set_flag(meta, index, ZRAM_UNDER_WB);
+		zram_unlock_table(meta, index);
+
+		blk_idx = alloc_block_bdev(zram, blk_idx + 1);
+		if (!blk_idx) {
+			zram_lock_table(meta, index);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_unlock_table(meta, index);
+			ret = -ENOSPC;
+			break;
+		}
+
+		mem = kmap(wb->pages[wb->nr]);
+		err = zram_decompress_page(zram, mem, index);
+		kunmap(wb->pages[wb->nr]);
+		if (err) {
+			zram_lock_table(meta, index);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_unlock_table(meta, index);
+			free_block_bdev(zram, blk_idx);
+			continue;
+		}
+
+		wb->index[wb->nr] = index;
+		wb->blk_idx[wb->nr] = blk_idx;
+		if (++wb->nr == ZRAM_WB_BATCH) {
+			err = zram_wb_flush(zram, wb);
+			if (err) {
+				ret = err;
+				break;
+			}
+		}
+		continue;
+next:
+		zram_unlock_table(meta, index);
 	}
-	spin_unlock(&zram->slot_free_lock);
+
+	i = zram_wb_flush(zram, wb);
+	if (i && ret == len)
+		ret = i;
+
+release_init_lock:
+	up_read(&zram->init_lock);
+free_pages:
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		if (wb->pages[i])
+			__free_page(wb->pages[i]);
+	kfree(wb);
+
+	return ret;
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count));
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+			(u64)atomic64_read(&zram->stats.bd_writes));
 }
+#endif
 
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
-		handle_pending_slot_free(zram);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
-		handle_pending_slot_free(zram);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -563,10 +1625,9 @@ static void zram_reset_device(struct zram *zram, bool reset_capacity)
 	size_t index;
 	struct zram_meta *meta;
 
-	flush_work(&zram->free_work);
-
 	down_write(&zram->init_lock);
 	if (!zram->init_done) {
+		reset_bdev(zram);
 		up_write(&zram->init_lock);
 		return;
 	}
@@ -576,13 +1637,19 @@ static void zram_reset_device(struct zram *zram, bool reset_capacity)
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		unsigned long handle = meta->table[index].handle;
-		if (!handle)
+		struct zram_obj obj = meta->table[index].obj;
+		if (zram_obj_empty(obj) ||
+				zram_test_flag(meta, index, ZRAM_SAME) ||
+				zram_test_flag(meta, index, ZRAM_WB))
 			continue;
 
-		zs_free(meta->mem_pool, handle);
+		zram_obj_free(zram, obj);
 	}
 
+	reset_bdev(zram);
+
+	zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 	zram_meta_free(zram->meta);
 	zram->meta = NULL;
 	/* Reset stats */
@@ -594,7 +1661,8 @@ static void zram_reset_device(struct zram *zram, bool reset_capacity)
 	up_write(&zram->init_lock);
 }
 
-static void zram_init_device(struct zram *zram, struct zram_meta *meta)
+static void zram_init_device(struct zram *zram, struct zram_meta *meta,
+			     struct zcomp *comp)
 {
 	if (zram->disksize > 2 * (totalram_pages << PAGE_SHIFT)) {
 		pr_info(
@@ -615,6 +1683,7 @@ static void zram_init_device(struct zram *zram, struct zram_meta *meta)
 	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, zram->disk->queue);
 
 	zram->meta = meta;
+	zram->comp = comp;
 	zram->init_done = 1;
 
 	pr_debug("Initialization done!\n");
@@ -625,7 +1694,9 @@ static ssize_t disksize_store(struct device *dev,
 {
 	u64 disksize;
 	struct zram_meta *meta;
+	struct zcomp *comp;
 	struct zram *zram = dev_to_zram(dev);
+	int err;
 
 	disksize = memparse(buf, NULL);
 	if (!disksize)
@@ -633,20 +1704,35 @@ static ssize_t disksize_store(struct device *dev,
 
 	disksize = PAGE_ALIGN(disksize);
 	meta = zram_meta_alloc(disksize);
+	if (!meta)
+		return -ENOMEM;
+
 	down_write(&zram->init_lock);
 	if (zram->init_done) {
-		up_write(&zram->init_lock);
-		zram_meta_free(meta);
 		pr_info("Cannot change disksize for initialized device\n");
-		return -EBUSY;
+		err = -EBUSY;
+		goto out_free_meta;
+	}
+
+	comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!comp) {
+		pr_err("Cannot initialise %s compressing backend\n",
+				zram->compressor);
+		err = -ENOMEM;
+		goto out_free_meta;
 	}
 
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
-	zram_init_device(zram, meta);
+	zram_init_device(zram, meta, comp);
 	up_write(&zram->init_lock);
 
 	return len;
+
+out_free_meta:
+	up_write(&zram->init_lock);
+	zram_meta_free(meta);
+	return err;
 }
 
 static ssize_t reset_store(struct device *dev,
@@ -760,40 +1846,23 @@ error:
 	bio_io_error(bio);
 }
 
-static void zram_slot_free(struct work_struct *work)
-{
-	struct zram *zram;
-
-	zram = container_of(work, struct zram, free_work);
-	down_write(&zram->lock);
-	handle_pending_slot_free(zram);
-	up_write(&zram->lock);
-}
-
-static void add_slot_free(struct zram *zram, struct zram_slot_free *free_rq)
-{
-	spin_lock(&zram->slot_free_lock);
-	free_rq->next = zram->slot_free_rq;
-	zram->slot_free_rq = free_rq;
-	spin_unlock(&zram->slot_free_lock);
-}
-
+/*
+ * Called from swap code with swap_lock held, so the slot is freed
+ * directly under its table entry lock instead of being deferred.
+ */
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
 	struct zram *zram;
-	struct zram_slot_free *free_rq;
+	struct zram_meta *meta;
 
 	zram = bdev->bd_disk->private_data;
-	atomic64_inc(&zram->stats.notify_free);
-
-	free_rq = kmalloc(sizeof(struct zram_slot_free), GFP_ATOMIC);
-	if (!free_rq)
-		return;
+	meta = zram->meta;
 
-	free_rq->index = index;
-	add_slot_free(zram, free_rq);
-	schedule_work(&zram->free_work);
+	zram_lock_table(meta, index);
+	zram_free_page(zram, index);
+	zram_unlock_table(meta, index);
+	atomic64_inc(&zram->stats.notify_free);
 }
 
 static const struct block_device_operations zram_devops = {
@@ -810,9 +1879,34 @@ static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dup_data_size, S_IRUGO, dup_data_size_show, NULL);
+static DEVICE_ATTR(dup_pages, S_IRUGO, dup_pages_show, NULL);
+#ifdef CONFIG_ZRAM_DEDUP
+static DEVICE_ATTR(use_dedup, S_IRUGO | S_IWUSR,
+		use_dedup_show, use_dedup_store);
+#else
+static DEVICE_ATTR(use_dedup, S_IRUGO, use_dedup_show, NULL);
+#endif
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(idle, S_IWUSR, NULL, idle_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -823,9 +1917,25 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dup_data_size.attr,
+	&dev_attr_dup_pages.attr,
+	&dev_attr_use_dedup.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+#endif
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_pages_compacted.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
 	NULL,
 };
 
@@ -837,13 +1947,8 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = -ENOMEM;
 
-	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 
-	INIT_WORK(&zram->free_work, zram_slot_free);
-	spin_lock_init(&zram->slot_free_lock);
-	zram->slot_free_rq = NULL;
-
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
@@ -892,6 +1997,8 @@ static int create_device(struct zram *zram, int device_id)
 	}
 
 	zram->init_done = 0;
+	zram->max_comp_streams = ZRAM_DEFAULT_COMP_STREAMS;
+	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 	return 0;
 
 out_free_disk:
@@ -935,11 +2042,15 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_entry_cache_create();
+	if (ret)
+		goto unregister;
+
 	/* Allocate the device array and initialize each one */
 	zram_devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
 	if (!zram_devices) {
 		ret = -ENOMEM;
-		goto unregister;
+		goto free_cache;
 	}
 
 	for (dev_id = 0; dev_id < num_devices; dev_id++) {
@@ -956,6 +2067,8 @@ free_devices:
 	while (dev_id)
 		destroy_device(&zram_devices[--dev_id]);
 	kfree(zram_devices);
+free_cache:
+	zram_entry_cache_destroy();
 unregister:
 	unregister_blkdev(zram_major, "zram");
 out:
@@ -981,6 +2094,7 @@ static void __exit zram_exit(void)
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(zram_devices);
+	zram_entry_cache_destroy();
 	pr_debug("Cleanup done!\n");
 }
 
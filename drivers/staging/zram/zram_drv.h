@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -40,6 +42,16 @@ static const size_t max_zpage_size = PAGE_SIZE / 10 * 9;
  * always return failure.
  */
 
+/*
+ * Default number of compression streams per device. Each stream costs
+ * two pages plus the compressor working memory, so this is kept at
+ * the number of online CPUs unless overridden via max_comp_streams.
+ */
+#define ZRAM_DEFAULT_COMP_STREAMS	num_online_cpus()
+
+/* Number of pages written back to the backing device per batch */
+#define ZRAM_WB_BATCH		32
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -51,27 +63,75 @@ static const size_t max_zpage_size = PAGE_SIZE / 10 * 9;
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
-/* Flags for zram pages (table[page_no].flags) */
+/*
+ * The lower ZRAM_FLAG_SHIFT bits of table.value hold the object size
+ * (excluding header), the higher bits hold zram_pageflags.
+ */
+#define ZRAM_FLAG_SHIFT		(PAGE_SHIFT + 1)
+
+/* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page consists of a single repeated word, kept in table.element */
+	ZRAM_SAME = ZRAM_FLAG_SHIFT,
+	/* Slot lock: held while the table entry is read or updated */
+	ZRAM_ACCESS,
+	/* Page is stored on the backing device at table.blk_idx */
+	ZRAM_WB,
+	/* Page is being written back; cleared if the slot changes */
+	ZRAM_UNDER_WB,
+	/* Page has not been accessed since it was last marked idle */
+	ZRAM_IDLE,
+	/* Page is incompressible and stored uncompressed */
+	ZRAM_HUGE,
+	/* table.blk_idx is being read; a free leaves the block to the reader */
+	ZRAM_BDEV_READ,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+#ifdef CONFIG_ZRAM_DEDUP
+/*
+ * A compressed object. Several table slots may point at the same entry;
+ * refcount counts those slots and is protected by the lock of the hash
+ * bucket the entry lives in.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 len;
+	u32 checksum;
+	unsigned long refcount;
+	unsigned long handle;
+};
+#endif
+
+/*
+ * The compressed object of a table slot. With deduplication it is an
+ * entry that other slots may share; without, nothing is shared and the
+ * slot holds the zsmalloc handle itself.
+ */
+struct zram_obj {
+#ifdef CONFIG_ZRAM_DEDUP
+	struct zram_entry *entry;
+#else
+	unsigned long handle;
+#endif
+};
+
 /* Allocated for each disk page */
 struct table {
-	unsigned long handle;
-	u16 size;	/* object size (excluding header) */
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __aligned(4);
+	union {
+		struct zram_obj obj;
+		unsigned long element;	/* fill word of a ZRAM_SAME page */
+		unsigned long blk_idx;	/* backing device block, ZRAM_WB */
+	};
+	unsigned long value;	/* object size and zram_pageflags */
+};
 
 /*
- * All 64bit fields should only be manipulated by 64bit atomic accessors.
- * All modifications to 32bit counter should be protected by zram->lock.
+ * Stats are updated without any device wide lock held, so every
+ * counter is manipulated through 64bit atomic accessors.
  */
 struct zram_stats {
 	atomic64_t compr_size;	/* compressed size of pages stored */
@@ -81,32 +141,37 @@ struct zram_stats {
 	atomic64_t failed_writes;	/* can happen when memory is too low */
 	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
 	atomic64_t notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 bad_compress;	/* % of pages with compression ratio>=75% */
+	atomic64_t pages_zero;		/* no. of zero filled pages */
+	atomic64_t pages_same;		/* no. of non-zero same filled pages */
+	atomic64_t dup_data_size;	/* compressed size of shared pages */
+	atomic64_t pages_dup;		/* no. of pages sharing an entry */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages on the backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes to backing device */
+#endif
+	atomic64_t pages_stored;	/* no. of pages currently stored */
+	atomic64_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic64_t bad_compress;	/* % of pages with compression ratio>=75% */
 };
 
+/*
+ * Each table entry is protected by its own ZRAM_ACCESS bit spinlock,
+ * so reads, writes and slot free notifications for different pages
+ * never contend with each other.
+ */
 struct zram_meta {
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
 	struct zs_pool *mem_pool;
-};
-
-struct zram_slot_free {
-	unsigned long index;
-	struct zram_slot_free *next;
+#ifdef CONFIG_ZRAM_DEDUP
+	struct zram_hash *hash;
+	size_t hash_size;
+#endif
 };
 
 struct zram {
 	struct zram_meta *meta;
-	struct rw_semaphore lock; /* protect compression buffers, table,
-				   * 32bit stat counters against concurrent
-				   * notifications, reads and writes */
-
-	struct work_struct free_work;  /* handle pending free request */
-	struct zram_slot_free *slot_free_rq; /* list head of free request */
+	struct zcomp *comp;
 
 	struct request_queue *queue;
 	struct gendisk *disk;
@@ -118,7 +183,16 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
-	spinlock_t slot_free_lock;
+	int max_comp_streams;
+	char compressor[10];
+	bool use_dedup;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 
 	struct zram_stats stats;
 };
@@ -56,6 +56,14 @@
  *	PG_private: identifies the first component page
  *	PG_private2: identifies the last component page
  *
+ * The handle returned by zs_malloc() does not encode the location of the
+ * object directly. It is the address of a small slot, allocated from
+ * zs_handle_cache, which holds the encoded location. Every object (except
+ * those of huge classes, see below) starts with a header holding its own
+ * handle, so that objects can be moved to another zspage by the compaction
+ * code and the handle updated in place. The low bit of the slot serves as
+ * a lock pinning the object while it is mapped or being freed.
+ *
  */
 
 #ifdef CONFIG_ZSMALLOC_DEBUG
@@ -78,6 +86,8 @@
 #include <linux/hardirq.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/bit_spinlock.h>
+#include <linux/mm.h>
 
 #include "zsmalloc.h"
 
@@ -119,9 +129,23 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+
+/*
+ * The low bit of an object's first word tells allocated objects, whose
+ * header holds their handle, from free ones, whose link_free holds the
+ * (shifted) location of the next free object.
+ */
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
+/* Room reserved in front of each object for its handle */
+#define ZS_HANDLE_SIZE	(sizeof(unsigned long))
+
+/* Bit of the handle slot used to pin an object in place */
+#define HANDLE_PIN_BIT	0
+
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
 /* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
 #define ZS_MIN_ALLOC_SIZE \
@@ -183,11 +207,19 @@ struct size_class {
 
 	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
 	int pages_per_zspage;
+	/* Number of objects a zspage of this class can store */
+	int objs_per_zspage;
+	/*
+	 * Huge classes hold a single object per single-page zspage. Their
+	 * objects carry no handle header and never need compaction.
+	 */
+	bool huge;
 
 	spinlock_t lock;
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -199,16 +231,29 @@ struct size_class {
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		void *next;
+		/* Handle of an allocated object, tagged OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
 	struct size_class size_class[ZS_SIZE_CLASSES];
 
 	gfp_t flags;	/* allocation flags used when growing pool */
+
+	/* compacts the pool when the system is short of memory */
+	struct shrinker shrinker;
+
+	/* stats */
+	atomic_long_t pages_compacted;
 };
 
+/* Slots holding the current object location for each handle */
+static struct kmem_cache *zs_handle_cache;
+
 /*
  * A zspage's class index and fullness group
  * are encoded in its (first)page->mapping
@@ -283,7 +328,7 @@ static int get_size_class_index(int size)
 		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
 				ZS_SIZE_CLASS_DELTA);
 
-	return idx;
+	return min_t(int, idx, ZS_SIZE_CLASSES - 1);
 }
 
 static enum fullness_group get_fullness_group(struct page *page)
@@ -431,36 +476,68 @@ static struct page *get_next_page(struct page *page)
 }
 
 /*
- * Encode <page, obj_idx> as a single handle value.
+ * Encode <page, obj_idx> as a single object value.
  * On hardware platforms with physical memory starting at 0x0 the pfn
- * could be 0 so we ensure that the handle will never be 0 by adjusting the
- * encoded obj_idx value before encoding.
+ * could be 0 so we ensure that the value will never be 0 by adjusting the
+ * encoded obj_idx value before encoding. The value is shifted so that its
+ * OBJ_TAG_BITS low bits are always clear.
  */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+static void *location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
 		return NULL;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= ((obj_idx + 1) & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= ((obj_idx + 1) & OBJ_INDEX_MASK);
+	obj <<= OBJ_TAG_BITS;
 
-	return (void *)handle;
+	return (void *)obj;
 }
 
 /*
- * Decode <page, obj_idx> pair from the given object handle. We adjust the
+ * Decode <page, obj_idx> pair from the given object value. We adjust the
  * decoded obj_idx back to its original value since it was adjusted in
- * obj_location_to_handle().
+ * location_to_obj().
  */
-static void obj_handle_to_location(unsigned long handle, struct page **page,
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	*page = pfn_to_page(handle >> OBJ_INDEX_BITS);
-	*obj_idx = (handle & OBJ_INDEX_MASK) - 1;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = (obj & OBJ_INDEX_MASK) - 1;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
+
+/*
+ * The pin bit is part of the same word, so it must be written in one go
+ * with the new location; callers holding the pin pass it in @obj.
+ */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj;
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -537,7 +614,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -548,7 +625,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -602,9 +679,9 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->pages_per_zspage * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; /* Success */
 
@@ -783,12 +860,22 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
+	zs_handle_cache = NULL;
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	/* the slot must be aligned so its low bit is free for HANDLE_PIN_BIT */
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					ZS_HANDLE_SIZE, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -801,6 +888,73 @@ fail:
 	return notifier_to_errno(ret);
 }
 
+static unsigned long alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(zs_handle_cache,
+			pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void free_handle(unsigned long handle)
+{
+	kmem_cache_free(zs_handle_cache, (void *)handle);
+}
+
+/*
+ * Number of pages that could be released by compacting @class, i.e.
+ * the number of whole zspages worth of free object slots.
+ * Must be called with class->lock held.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	if (class->huge)
+		return 0;
+
+	obj_wasted = (unsigned long)class->pages_allocated /
+			class->pages_per_zspage * class->objs_per_zspage;
+	obj_wasted -= class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+static unsigned long __zs_compact_pool(struct zs_pool *pool,
+					unsigned long nr_to_free);
+
+static unsigned long zs_shrinker_count(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages_freeable = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		pages_freeable += zs_can_compact(class);
+		spin_unlock(&class->lock);
+	}
+
+	return pages_freeable;
+}
+
+static int zs_shrinker_shrink(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	/*
+	 * Compaction only takes class spinlocks, never allocates and does
+	 * no I/O, so it is safe in any reclaim context; it does reschedule
+	 * between zspages. Free at most nr_to_scan pages per call instead
+	 * of compacting the whole pool.
+	 */
+	if (sc->nr_to_scan)
+		__zs_compact_pool(pool, sc->nr_to_scan);
+
+	return min_t(unsigned long, zs_shrinker_count(pool), INT_MAX);
+}
+
 /**
  * zs_create_pool - Creates an allocation pool to work from.
  * @flags: allocation flags used to allocate pool metadata
@@ -834,11 +988,19 @@ struct zs_pool *zs_create_pool(gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->pages_per_zspage = get_pages_per_zspage(size);
-
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / size;
+		if (class->pages_per_zspage == 1 &&
+				class->objs_per_zspage == 1)
+			class->huge = true;
 	}
 
 	pool->flags = flags;
 
+	pool->shrinker.shrink = zs_shrinker_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
 	return pool;
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
@@ -847,6 +1009,8 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	unregister_shrinker(&pool->shrinker);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -862,6 +1026,63 @@ void zs_destroy_pool(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_destroy_pool);
 
+/*
+ * Take a free object from @first_page, which must have one, and store
+ * @handle in its header. Must be called with class->lock held.
+ */
+static unsigned long obj_malloc(struct page *first_page,
+		struct size_class *class, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)kmap_atomic(m_page) +
+					m_offset / sizeof(*link);
+	first_page->freelist = link->next;
+	if (!class->huge)
+		link->handle = handle | OBJ_ALLOCATED_TAG;
+	else
+		memset(link, POISON_INUSE, sizeof(*link));
+	kunmap_atomic(link);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/*
+ * Put @obj back on its zspage's freelist. The caller is responsible for
+ * fixing the zspage's fullness group. Must be called with class->lock held.
+ */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	/* Insert this object in containing zspage's freelist */
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
 /**
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
@@ -873,17 +1094,20 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  */
 unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 {
-	unsigned long obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
-
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	struct page *first_page;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
+	handle = alloc_handle(pool);
+	if (!handle)
+		return 0;
+
+	/* extra space in chunk to keep the handle */
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -894,72 +1118,62 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			free_handle(handle);
 			return 0;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->pages_per_zspage;
 	}
 
-	obj = (unsigned long)first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(first_page, class, handle);
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
+	/* compaction may find the handle as soon as the lock is dropped */
+	record_obj(handle, obj);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, unsigned long obj)
+void zs_free(struct zs_pool *pool, unsigned long handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long obj, f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* keep compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = (void *)obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
 	if (fullness == ZS_EMPTY)
 		class->pages_allocated -= class->pages_per_zspage;
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
+
+	free_handle(handle);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
@@ -973,7 +1187,8 @@ EXPORT_SYMBOL_GPL(zs_free);
  * zs_unmap_object.
  *
  * Only one object can be mapped per cpu at a time. There is no protection
- * against nested mappings.
+ * against nested mappings. The object is pinned, and cannot be freed or
+ * migrated, until it is unmapped.
  *
  * This function returns with preemption and page faults disabled.
  */
@@ -981,13 +1196,14 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 			enum zs_mapmode mm)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
 	struct page *pages[2];
+	int hdr;
 
 	BUG_ON(!handle);
 
@@ -998,17 +1214,21 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	 */
 	BUG_ON(in_interrupt());
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag(handle);
+
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
+	hdr = class->huge ? 0 : ZS_HANDLE_SIZE;
 
 	area = &get_cpu_var(zs_map_area);
 	area->vm_mm = mm;
 	if (off + class->size <= PAGE_SIZE) {
 		/* this object is contained entirely within a page */
 		area->vm_addr = kmap_atomic(page);
-		return area->vm_addr + off;
+		return area->vm_addr + off + hdr;
 	}
 
 	/* this object spans two pages */
@@ -1016,26 +1236,29 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	pages[1] = get_next_page(page);
 	BUG_ON(!pages[1]);
 
-	return __zs_map_object(area, pages, off, class->size);
+	return __zs_map_object(area, pages, off + hdr, class->size - hdr);
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
 void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
+	int hdr;
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
+	hdr = class->huge ? 0 : ZS_HANDLE_SIZE;
 
 	area = &__get_cpu_var(zs_map_area);
 	if (off + class->size <= PAGE_SIZE)
@@ -1047,12 +1270,291 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 		pages[1] = get_next_page(page);
 		BUG_ON(!pages[1]);
 
-		__zs_unmap_object(area, pages, off, class->size);
+		__zs_unmap_object(area, pages, off + hdr, class->size - hdr);
 	}
 	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
+/* Copy a whole object, header included, from @src to @dst */
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	void *s_addr, *d_addr;
+	int s_size, d_size, size;
+	int written = 0;
+
+	s_size = d_size = class->size;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	if (s_off + class->size > PAGE_SIZE)
+		s_size = PAGE_SIZE - s_off;
+
+	if (d_off + class->size > PAGE_SIZE)
+		d_size = PAGE_SIZE - d_off;
+
+	s_addr = kmap_atomic(s_page);
+	d_addr = kmap_atomic(d_page);
+
+	while (1) {
+		size = min(s_size, d_size);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		written += size;
+
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		s_size -= size;
+		d_off += size;
+		d_size -= size;
+
+		/* kmap_atomic() mappings must be released in reverse order */
+		if (s_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			kunmap_atomic(s_addr);
+			s_page = get_next_page(s_page);
+			BUG_ON(!s_page);
+			s_addr = kmap_atomic(s_page);
+			d_addr = kmap_atomic(d_page);
+			s_size = class->size - written;
+			s_off = 0;
+		}
+
+		if (d_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			d_page = get_next_page(d_page);
+			BUG_ON(!d_page);
+			d_addr = kmap_atomic(d_page);
+			d_size = class->size - written;
+			d_off = 0;
+		}
+	}
+
+	kunmap_atomic(d_addr);
+	kunmap_atomic(s_addr);
+}
+
+/*
+ * Find the first allocated object at or after *obj_idx in @page that is
+ * not pinned by a user, pin it and return its handle, or 0 if there is
+ * none. *obj_idx is advanced past the objects that were looked at.
+ */
+static unsigned long find_alloced_obj(struct page *page, unsigned long *obj_idx,
+					struct size_class *class)
+{
+	unsigned long head, handle = 0;
+	unsigned long offset, index = *obj_idx;
+	void *addr;
+
+	offset = obj_idx_to_offset(page, index, class->size);
+	addr = kmap_atomic(page);
+
+	/* the tail of the last page is unused and never initialized */
+	while (offset < PAGE_SIZE && (!is_last_page(page) ||
+				offset + class->size <= PAGE_SIZE)) {
+		head = *(unsigned long *)(addr + offset);
+		if (head & OBJ_ALLOCATED_TAG) {
+			handle = head & ~OBJ_ALLOCATED_TAG;
+			if (trypin_tag(handle))
+				break;
+			handle = 0;
+		}
+
+		offset += class->size;
+		index++;
+	}
+
+	kunmap_atomic(addr);
+	*obj_idx = index;
+
+	return handle;
+}
+
+struct zs_compact_control {
+	/* source zspage sub-page and index of the next object to look at */
+	struct page *s_page;
+	unsigned long index;
+	/* first page of the destination zspage */
+	struct page *d_page;
+};
+
+/*
+ * Move objects from the source zspage to the destination one until either
+ * the source has no movable objects left (returns 0) or the destination
+ * is full (returns -ENOMEM). Must be called with class->lock held.
+ */
+static int migrate_zspage(struct size_class *class,
+				struct zs_compact_control *cc)
+{
+	unsigned long used_obj, free_obj;
+	unsigned long handle;
+	struct page *s_page = cc->s_page;
+	struct page *d_page = cc->d_page;
+	unsigned long index = cc->index;
+	int ret = 0;
+
+	while (1) {
+		handle = find_alloced_obj(s_page, &index, class);
+		if (!handle) {
+			s_page = get_next_page(s_page);
+			if (!s_page)
+				break;
+			index = 0;
+			continue;
+		}
+
+		/* stop if there is no more space */
+		if (d_page->inuse == d_page->objects) {
+			unpin_tag(handle);
+			ret = -ENOMEM;
+			break;
+		}
+
+		used_obj = handle_to_obj(handle);
+		free_obj = obj_malloc(d_page, class, handle);
+		zs_object_copy(free_obj, used_obj, class);
+		index++;
+		/* the handle stays pinned until the new location is visible */
+		record_obj(handle, free_obj | (1UL << HANDLE_PIN_BIT));
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+	}
+
+	/* remember the position for the next destination zspage */
+	cc->s_page = s_page;
+	cc->index = index;
+
+	return ret;
+}
+
+static struct page *isolate_zspage(struct size_class *class,
+				enum fullness_group fullness)
+{
+	struct page *page = class->fullness_list[fullness];
+
+	if (page)
+		remove_zspage(page, class, fullness);
+
+	return page;
+}
+
+/*
+ * Return an isolated zspage to the fullness list it now belongs to, or
+ * free it if it became empty. Must be called with class->lock held.
+ */
+static enum fullness_group putback_zspage(struct size_class *class,
+					struct page *first_page)
+{
+	enum fullness_group fullness;
+
+	fullness = get_fullness_group(first_page);
+	insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+
+	if (fullness == ZS_EMPTY) {
+		class->pages_allocated -= class->pages_per_zspage;
+		free_zspage(first_page);
+	}
+
+	return fullness;
+}
+
+/*
+ * Drain ZS_ALMOST_EMPTY zspages of @class into ZS_ALMOST_FULL ones (or,
+ * failing that, into other ZS_ALMOST_EMPTY ones) and free them. Stops as
+ * soon as a source zspage cannot be emptied, e.g. because one of its
+ * objects is mapped, or once @nr_to_free pages have been freed. Returns
+ * the number of pages freed.
+ */
+static unsigned long __zs_compact(struct size_class *class,
+					unsigned long nr_to_free)
+{
+	struct zs_compact_control cc;
+	struct page *src_page, *dst_page;
+	unsigned long pages_freed = 0;
+
+	spin_lock(&class->lock);
+	while (pages_freed < nr_to_free && zs_can_compact(class)) {
+		src_page = isolate_zspage(class, ZS_ALMOST_EMPTY);
+		if (!src_page)
+			break;
+
+		cc.s_page = src_page;
+		cc.index = 0;
+
+		while (1) {
+			dst_page = isolate_zspage(class, ZS_ALMOST_FULL);
+			if (!dst_page)
+				dst_page = isolate_zspage(class,
+							ZS_ALMOST_EMPTY);
+			if (!dst_page)
+				break;
+
+			cc.d_page = dst_page;
+			if (!migrate_zspage(class, &cc))
+				break;
+
+			putback_zspage(class, dst_page);
+		}
+
+		if (dst_page)
+			putback_zspage(class, dst_page);
+
+		if (putback_zspage(class, src_page) != ZS_EMPTY)
+			break;
+
+		pages_freed += class->pages_per_zspage;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return pages_freed;
+}
+
+static unsigned long __zs_compact_pool(struct zs_pool *pool,
+					unsigned long nr_to_free)
+{
+	int i;
+	unsigned long pages_freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && pages_freed < nr_to_free; i--)
+		pages_freed += __zs_compact(&pool->size_class[i],
+						nr_to_free - pages_freed);
+
+	atomic_long_add(pages_freed, &pool->pages_compacted);
+
+	return pages_freed;
+}
+
+/**
+ * zs_compact - Migrate objects to free sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Objects in use are never moved, so this can run concurrently with
+ * other pool operations. May sleep.
+ *
+ * Returns the number of pages released back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	return __zs_compact_pool(pool, ULONG_MAX);
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
 u64 zs_get_total_size_bytes(struct zs_pool *pool)
 {
 	int i;
@@ -1065,6 +1567,12 @@ u64 zs_get_total_size_bytes(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
 
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
 module_init(zs_init);
 module_exit(zs_exit);
 
@@ -954,6 +954,12 @@ static int de_thread(struct task_struct *tsk)
 
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
+		/*
+		 * Only now, so that a racing oom_adj_bucket_update() either
+		 * rehashes the old leader before the handover or finds tsk
+		 * already hashed with the new score.
+		 */
+		oom_adj_bucket_replace(leader, tsk);
 
 		tsk->exit_signal = SIGCHLD;
 		leader->exit_signal = -1;
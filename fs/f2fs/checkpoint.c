@@ -1110,6 +1110,45 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	return 0;
 }
 
+struct nat_flush_work {
+	struct work_struct work;
+	struct f2fs_sb_info *sbi;
+};
+
+static void flush_nat_entries_work(struct work_struct *work)
+{
+	struct nat_flush_work *nfw = container_of(work,
+					struct nat_flush_work, work);
+
+	flush_nat_entries(nfw->sbi);
+}
+
+/*
+ * NAT and SIT entries go to disjoint meta areas and journals (hot and cold
+ * data summary), so a worker prepares the NAT pages while we do the SIT ones.
+ * do_checkpoint() then writes both out in merged META bios.
+ */
+static void flush_nat_sit_entries(struct f2fs_sb_info *sbi,
+						struct cp_control *cpc)
+{
+	struct nat_flush_work nfw;
+
+	if (!NM_I(sbi)->dirty_nat_cnt || !SIT_I(sbi)->dirty_sentries) {
+		flush_nat_entries(sbi);
+		flush_sit_entries(sbi, cpc);
+		return;
+	}
+
+	nfw.sbi = sbi;
+	INIT_WORK_ONSTACK(&nfw.work, flush_nat_entries_work);
+	queue_work(system_unbound_wq, &nfw.work);
+
+	flush_sit_entries(sbi, cpc);
+
+	flush_work(&nfw.work);
+	destroy_work_on_stack(&nfw.work);
+}
+
 /*
  * We guarantee that this checkpoint procedure will not fail.
  */
@@ -1117,6 +1156,7 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 {
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
 	unsigned long long ckpt_ver;
+	ktime_t block_start;
 	int err = 0;
 
 	mutex_lock(&sbi->cp_mutex);
@@ -1140,6 +1180,8 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (err)
 		goto out;
 
+	block_start = ktime_get();
+
 	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "finish block_ops");
 
 	f2fs_flush_merged_bios(sbi);
@@ -1153,14 +1195,15 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	ckpt->checkpoint_ver = cpu_to_le64(++ckpt_ver);
 
 	/* write cached NAT/SIT entries to NAT/SIT area */
-	flush_nat_entries(sbi);
-	flush_sit_entries(sbi, cpc);
+	flush_nat_sit_entries(sbi, cpc);
 
 	/* unlock all the fs_lock[] in do_checkpoint() */
 	err = do_checkpoint(sbi, cpc);
 
 	unblock_operations(sbi);
 	stat_inc_cp_count(sbi->stat_info);
+	stat_add_cp_block_time(sbi->stat_info,
+			ktime_us_delta(ktime_get(), block_start));
 
 	if (cpc->reason == CP_RECOVERY)
 		f2fs_msg(sbi->sb, KERN_NOTICE,
@@ -72,6 +72,15 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 	si->dirty_sits = SIT_I(sbi)->dirty_sentries;
 	si->fnids = NM_I(sbi)->fcnt;
 	si->bg_gc = sbi->bg_gc;
+	if (SM_I(sbi)->dcc_info) {
+		struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+		spin_lock(&dcc->discard_lock);
+		si->discard_pending = dcc->pending_blks;
+		si->discard_cmds = dcc->issued_cmds;
+		si->discard_blks = dcc->issued_blks;
+		spin_unlock(&dcc->discard_lock);
+	}
 	si->util_free = (int)(free_user_blocks(sbi) >> sbi->log_blocks_per_seg)
 		* 100 / (int)(sbi->user_block_count >> sbi->log_blocks_per_seg)
 		/ 2;
@@ -174,6 +183,9 @@ static void update_mem_info(struct f2fs_sb_info *sbi)
 	/* build nm */
 	si->base_mem += sizeof(struct f2fs_nm_info);
 	si->base_mem += __bitmap_size(sbi, NAT_BITMAP);
+	si->base_mem += BITS_TO_LONGS(NM_I(sbi)->nat_blocks) * sizeof(long);
+	si->base_mem += NM_I(sbi)->nat_blocks * (sizeof(unsigned short) +
+				NAT_ENTRY_BITMAP_LONGS * sizeof(long));
 
 get_cache:
 	si->cache_mem = 0;
@@ -186,6 +198,14 @@ get_cache:
 	if (SM_I(sbi)->cmd_control_info)
 		si->cache_mem += sizeof(struct flush_cmd_control);
 
+	/* build discard thread */
+	if (SM_I(sbi)->dcc_info) {
+		si->cache_mem += sizeof(struct discard_cmd_control);
+		si->cache_mem += f2fs_bitmap_size(MAIN_SEGS(sbi));
+		si->cache_mem += SM_I(sbi)->dcc_info->nr_ranges *
+					sizeof(struct discard_range);
+	}
+
 	/* free nids */
 	si->cache_mem += NM_I(sbi)->fcnt * sizeof(struct free_nid);
 	si->cache_mem += NM_I(sbi)->nat_cnt * sizeof(struct nat_entry);
@@ -272,8 +292,14 @@ static int stat_show(struct seq_file *s, void *v)
 			   si->dirty_count);
 		seq_printf(s, "  - Prefree: %d\n  - Free: %d (%d)\n\n",
 			   si->prefree_count, si->free_segs, si->free_secs);
+		seq_printf(s, "Discard: %u blocks pending\n",
+			   si->discard_pending);
+		seq_printf(s, "  - issued: %llu blocks in %llu cmds\n",
+			   si->discard_blks, si->discard_cmds);
 		seq_printf(s, "CP calls: %d (BG: %d)\n",
 				si->cp_count, si->bg_cp_count);
+		seq_printf(s, "  - ops blocked: %llu us (max: %llu us)\n",
+				si->cp_block_time, si->cp_block_max);
 		seq_printf(s, "GC calls: %d (BG: %d)\n",
 			   si->call_count, si->bg_gc);
 		seq_printf(s, "  - data segments : %d (%d)\n",
@@ -80,6 +80,7 @@ static struct f2fs_dir_entry *find_in_block(struct page *dentry_page,
 				struct fscrypt_name *fname,
 				f2fs_hash_t namehash,
 				int *max_slots,
+				bool *hash_seen,
 				struct page **res_page)
 {
 	struct f2fs_dentry_block *dentry_blk;
@@ -89,7 +90,7 @@ static struct f2fs_dir_entry *find_in_block(struct page *dentry_page,
 	dentry_blk = (struct f2fs_dentry_block *)kmap(dentry_page);
 
 	make_dentry_ptr(NULL, &d, (void *)dentry_blk, 1);
-	de = find_target_dentry(fname, namehash, max_slots, &d);
+	de = find_target_dentry(fname, namehash, max_slots, hash_seen, &d);
 	if (de)
 		*res_page = dentry_page;
 	else
@@ -105,7 +106,7 @@ static struct f2fs_dir_entry *find_in_block(struct page *dentry_page,
 
 struct f2fs_dir_entry *find_target_dentry(struct fscrypt_name *fname,
 			f2fs_hash_t namehash, int *max_slots,
-			struct f2fs_dentry_ptr *d)
+			bool *hash_seen, struct f2fs_dentry_ptr *d)
 {
 	struct f2fs_dir_entry *de;
 	unsigned long bit_pos = 0;
@@ -137,6 +138,9 @@ struct f2fs_dir_entry *find_target_dentry(struct fscrypt_name *fname,
 			!memcmp(de_name.name, name->name, name->len))
 			goto found;
 
+		if (hash_seen && de->hash_code == namehash)
+			*hash_seen = true;
+
 		if (max_slots && max_len > *max_slots)
 			*max_slots = max_len;
 		max_len = 0;
@@ -155,9 +159,45 @@ found:
 	return de;
 }
 
+/*
+ * Issue the reads for the dentry blocks of the buckets @namehash maps to in
+ * @nr_levels levels from @level on, under one plug so that they are merged
+ * and the lookup waits for a whole bucket at once instead of block by block.
+ */
+static void ra_dentry_buckets(struct inode *dir, f2fs_hash_t namehash,
+				unsigned int level, unsigned int nr_levels)
+{
+	unsigned long npages = dir_blocks(dir);
+	unsigned long bidx, end_block;
+	unsigned int nbucket;
+	struct blk_plug plug;
+	struct page *page;
+
+	blk_start_plug(&plug);
+	for (; nr_levels; level++, nr_levels--) {
+		nbucket = dir_buckets(level, F2FS_I(dir)->i_dir_level);
+		bidx = dir_block_index(level, F2FS_I(dir)->i_dir_level,
+					le32_to_cpu(namehash) % nbucket);
+		end_block = min_t(unsigned long,
+					bidx + bucket_blocks(level), npages);
+
+		for (; bidx < end_block; bidx++) {
+			page = find_get_page(dir->i_mapping, bidx);
+			if (!page)
+				page = get_read_data_page(dir, bidx,
+							READA, false);
+			if (!IS_ERR(page))
+				f2fs_put_page(page, 0);
+		}
+	}
+	blk_finish_plug(&plug);
+}
+
 static struct f2fs_dir_entry *find_in_level(struct inode *dir,
 					unsigned int level,
 					struct fscrypt_name *fname,
+					f2fs_hash_t namehash,
+					bool *hash_seen,
 					struct page **res_page)
 {
 	struct qstr name = FSTR_TO_QSTR(&fname->disk_name);
@@ -168,9 +208,6 @@ static struct f2fs_dir_entry *find_in_level(struct inode *dir,
 	struct f2fs_dir_entry *de = NULL;
 	bool room = false;
 	int max_slots;
-	f2fs_hash_t namehash;
-
-	namehash = f2fs_dentry_hash(&name);
 
 	nbucket = dir_buckets(level, F2FS_I(dir)->i_dir_level);
 	nblock = bucket_blocks(level);
@@ -188,7 +225,7 @@ static struct f2fs_dir_entry *find_in_level(struct inode *dir,
 		}
 
 		de = find_in_block(dentry_page, fname, namehash, &max_slots,
-								res_page);
+							hash_seen, res_page);
 		if (de)
 			break;
 
@@ -205,6 +242,49 @@ static struct f2fs_dir_entry *find_in_level(struct inode *dir,
 	return de;
 }
 
+static unsigned int lookup_dir_hint(struct inode *dir, f2fs_hash_t namehash,
+							unsigned int *gen)
+{
+	struct f2fs_inode_info *fi = F2FS_I(dir);
+	struct dir_hint *hint;
+	unsigned int level = F2FS_HINT_NONE;
+
+	hint = &fi->i_hints[le32_to_cpu(namehash) % F2FS_DIR_HINTS];
+
+	spin_lock(&dir->i_lock);
+	*gen = fi->i_dir_gen;
+	if (hint->hash == namehash &&
+		(hint->level != F2FS_HINT_NEG || hint->gen == *gen))
+		level = hint->level;
+	spin_unlock(&dir->i_lock);
+	return level;
+}
+
+static void update_dir_hint(struct inode *dir, f2fs_hash_t namehash,
+				unsigned int level, unsigned int gen)
+{
+	struct f2fs_inode_info *fi = F2FS_I(dir);
+	struct dir_hint *hint;
+
+	hint = &fi->i_hints[le32_to_cpu(namehash) % F2FS_DIR_HINTS];
+
+	spin_lock(&dir->i_lock);
+	/* a miss is stale if any dentry was added since the lookup began */
+	if (level != F2FS_HINT_NEG || fi->i_dir_gen == gen) {
+		hint->hash = namehash;
+		hint->level = level;
+		hint->gen = gen;
+	}
+	spin_unlock(&dir->i_lock);
+}
+
+static void invalidate_dir_hints(struct inode *dir)
+{
+	spin_lock(&dir->i_lock);
+	F2FS_I(dir)->i_dir_gen++;
+	spin_unlock(&dir->i_lock);
+}
+
 /*
  * Find an entry in the specified directory with the wanted name.
  * It returns the page where the entry was found (as a parameter - res_page),
@@ -218,7 +298,11 @@ struct f2fs_dir_entry *f2fs_find_entry(struct inode *dir,
 	struct f2fs_dir_entry *de = NULL;
 	unsigned int max_depth;
 	unsigned int level;
+	unsigned int hint = F2FS_HINT_NONE, gen = 0;
 	struct fscrypt_name fname;
+	struct qstr name;
+	f2fs_hash_t namehash;
+	bool hash_seen = false;
 	int err;
 
 	*res_page = NULL;
@@ -245,11 +329,43 @@ struct f2fs_dir_entry *f2fs_find_entry(struct inode *dir,
 		mark_inode_dirty(dir);
 	}
 
+	name = FSTR_TO_QSTR(&fname.disk_name);
+	namehash = f2fs_dentry_hash(&name);
+
+	/* no-key names are matched by their hash only, keep them out */
+	if (!fname.hash)
+		hint = lookup_dir_hint(dir, namehash, &gen);
+
+	if (hint == F2FS_HINT_NEG)
+		goto out;
+
+	if (hint < max_depth) {
+		ra_dentry_buckets(dir, namehash, hint, 1);
+		de = find_in_level(dir, hint, &fname, namehash,
+						&hash_seen, res_page);
+		if (de)
+			goto out;
+	}
+
 	for (level = 0; level < max_depth; level++) {
-		de = find_in_level(dir, level, &fname, res_page);
+		if (level == hint)
+			continue;
+
+		/* overlap the reads of the next level with this one */
+		ra_dentry_buckets(dir, namehash, level,
+					level + 1 < max_depth ? 2 : 1);
+		de = find_in_level(dir, level, &fname, namehash,
+						&hash_seen, res_page);
 		if (de)
 			break;
 	}
+
+	/*
+	 * Cache where the name lives, or that it is absent; the latter only
+	 * when no other name in the directory shares its hash.
+	 */
+	if (!fname.hash && (de || !hash_seen))
+		update_dir_hint(dir, namehash, de ? level : F2FS_HINT_NEG, gen);
 out:
 	fscrypt_free_filename(&fname);
 	return de;
@@ -629,6 +745,8 @@ fail:
 	kunmap(dentry_page);
 	f2fs_put_page(dentry_page, 1);
 out:
+	if (!err)
+		invalidate_dir_hints(dir);
 	fscrypt_free_filename(&fname);
 	f2fs_update_time(F2FS_I_SB(dir), REQ_TIME);
 	return err;
@@ -866,12 +984,12 @@ static int f2fs_readdir(struct file *file, void *dirent, filldir_t filldir)
 	bit_pos = (pos % NR_DENTRY_IN_BLOCK);
 	n = (pos / NR_DENTRY_IN_BLOCK);
 
-	/* readahead for multi pages of dir */
-	if (npages - n > 1 && !ra_has_index(ra, n))
-		page_cache_sync_readahead(inode->i_mapping, ra, file, n,
-				min(npages - n, (pgoff_t)MAX_DIR_RA_PAGES));
-
 	for (; n < npages; n++) {
+		/* readahead for multi pages of dir */
+		if (npages - n > 1 && !ra_has_index(ra, n))
+			page_cache_sync_readahead(inode->i_mapping, ra, file,
+				n, min(npages - n, (pgoff_t)MAX_DIR_RA_PAGES));
+
 		dentry_page = get_lock_data_page(inode, n, false);
 		if (IS_ERR(dentry_page)) {
 			err = PTR_ERR(dentry_page);
@@ -881,6 +999,11 @@ static int f2fs_readdir(struct file *file, void *dirent, filldir_t filldir)
 				goto out;
 		}
 
+		/* keep the next window in flight while this block is parsed */
+		if (PageReadahead(dentry_page))
+			page_cache_async_readahead(inode->i_mapping, ra, file,
+					dentry_page, n, npages - n);
+
 		dentry_blk = kmap(dentry_page);
 
 		make_dentry_ptr(inode, &d, (void *)dentry_blk, 1);
@@ -158,6 +158,8 @@ enum {
 		(SM_I(sbi)->trim_sections * (sbi)->segs_per_sec)
 #define BATCHED_TRIM_BLOCKS(sbi)	\
 		(BATCHED_TRIM_SEGMENTS(sbi) << (sbi)->log_blocks_per_seg)
+#define DEF_MAX_DISCARD_ISSUE		2048	/* blocks per round */
+#define DEF_DISCARD_ISSUE_INTERVAL	50	/* 50 ms */
 #define DEF_CP_INTERVAL			60	/* 60 secs */
 #define DEF_IDLE_INTERVAL		120	/* 2 mins */
 
@@ -206,6 +208,13 @@ struct discard_entry {
 	int len;		/* # of consecutive blocks of the discard */
 };
 
+/* for the tree of blockaddresses waiting for the discard thread */
+struct discard_range {
+	struct rb_node rb_node;	/* rb-tree node, sorted by blkaddr */
+	block_t blkaddr;	/* start block address of the range */
+	block_t len;		/* # of consecutive blocks of the range */
+};
+
 /* for the list of fsync inodes, used only during recovery */
 struct fsync_inode_entry {
 	struct list_head list;	/* list head */
@@ -424,6 +433,22 @@ struct f2fs_map_blocks {
 
 #define DEF_DIR_LEVEL		0
 
+/*
+ * Each directory remembers the level at which a few recently looked-up
+ * hashes were found, so that repeated lookups in a deep directory can skip
+ * the levels in front of it.  A miss is cached as F2FS_HINT_NEG together
+ * with i_dir_gen, which every dentry insertion bumps.
+ */
+#define F2FS_DIR_HINTS		4	/* # of lookup hints per directory */
+#define F2FS_HINT_NEG		((unsigned int)-1)
+#define F2FS_HINT_NONE		((unsigned int)-2)
+
+struct dir_hint {
+	f2fs_hash_t hash;		/* hash value of looked-up name */
+	unsigned int level;		/* level of entry or F2FS_HINT_NEG */
+	unsigned int gen;		/* i_dir_gen when a miss was cached */
+};
+
 struct f2fs_inode_info {
 	struct inode vfs_inode;		/* serve a vfs inode */
 	unsigned long i_flags;		/* keep an inode flags for ioctl */
@@ -439,6 +464,8 @@ struct f2fs_inode_info {
 	atomic_t dirty_pages;		/* # of dirty pages */
 	f2fs_hash_t chash;		/* hash value of given file name */
 	unsigned int clevel;		/* maximum level of given file name */
+	struct dir_hint i_hints[F2FS_DIR_HINTS];	/* recent lookup hints */
+	unsigned int i_dir_gen;		/* bumped on every dentry insertion */
 	nid_t i_xattr_nid;		/* node id that contains xattrs */
 	unsigned long long xattr_ver;	/* cp version of xattr modification */
 
@@ -529,6 +556,12 @@ struct f2fs_nm_info {
 	unsigned int fcnt;		/* the number of free node id */
 	struct mutex build_lock;	/* lock for build free nids */
 
+	/* free nid bitmaps of the nat blocks which have been scanned */
+	unsigned int nat_blocks;	/* # of nat blocks */
+	unsigned long *nat_block_bitmap;	/* scanned nat blocks */
+	unsigned long *free_nid_bitmap;	/* free nids of scanned nat blocks */
+	unsigned short *free_nid_count;	/* # of free nids per nat block */
+
 	/* for checkpoint */
 	char *nat_bitmap;		/* NAT bitmap pointer */
 	int bitmap_size;		/* bitmap size */
@@ -603,6 +636,21 @@ struct flush_cmd_control {
 	struct llist_node *dispatch_list;	/* list for command dispatch */
 };
 
+struct discard_cmd_control {
+	struct task_struct *f2fs_issue_discard;	/* discard thread */
+	wait_queue_head_t discard_wait_queue;	/* waiting queue for wake-up */
+	wait_queue_head_t discard_done_queue;	/* waiters for issued range */
+	spinlock_t discard_lock;		/* protects the fields below */
+	struct rb_root root;			/* merged pending ranges */
+	unsigned long *pending_segmap;		/* segments with pending ranges */
+	block_t issue_blkaddr;			/* range being issued */
+	block_t issue_len;
+	unsigned int nr_ranges;			/* # of ranges in the tree */
+	unsigned int pending_blks;		/* # of blocks in the tree */
+	unsigned long long issued_cmds;		/* # of discards issued */
+	unsigned long long issued_blks;		/* # of blocks discarded */
+};
+
 struct f2fs_sm_info {
 	struct sit_info *sit_info;		/* whole segment information */
 	struct free_segmap_info *free_info;	/* free segment information */
@@ -626,6 +674,10 @@ struct f2fs_sm_info {
 	int nr_discards;			/* # of discards in the list */
 	int max_discards;			/* max. discards to be issued */
 
+	/* for the discard thread */
+	unsigned int max_discard_issue;		/* max. blocks issued a round */
+	unsigned int discard_issue_interval;	/* ms between rounds */
+
 	/* for batched trimming */
 	unsigned int trim_sections;		/* # of sections to trim */
 
@@ -638,6 +690,9 @@ struct f2fs_sm_info {
 	/* for flush command control */
 	struct flush_cmd_control *cmd_control_info;
 
+	/* for discard command control */
+	struct discard_cmd_control *dcc_info;
+
 };
 
 /*
@@ -1752,7 +1807,7 @@ struct dentry *f2fs_get_parent(struct dentry *child);
 extern unsigned char f2fs_filetype_table[F2FS_FT_MAX];
 void set_de_type(struct f2fs_dir_entry *, umode_t);
 struct f2fs_dir_entry *find_target_dentry(struct fscrypt_name *,
-			f2fs_hash_t, int *, struct f2fs_dentry_ptr *);
+			f2fs_hash_t, int *, bool *, struct f2fs_dentry_ptr *);
 bool f2fs_fill_dentries(struct file *, void *, filldir_t,
 			struct f2fs_dentry_ptr *, unsigned int,
 			unsigned int, struct fscrypt_str *);
@@ -1851,6 +1906,8 @@ void f2fs_balance_fs_bg(struct f2fs_sb_info *);
 int f2fs_issue_flush(struct f2fs_sb_info *);
 int create_flush_cmd_control(struct f2fs_sb_info *);
 void destroy_flush_cmd_control(struct f2fs_sb_info *);
+int create_discard_cmd_control(struct f2fs_sb_info *);
+void destroy_discard_cmd_control(struct f2fs_sb_info *);
 void invalidate_blocks(struct f2fs_sb_info *, block_t);
 bool is_checkpointed_data(struct f2fs_sb_info *, block_t);
 void refresh_sit_entry(struct f2fs_sb_info *, block_t, block_t);
@@ -1931,6 +1988,7 @@ struct page *get_read_data_page(struct inode *, pgoff_t, int, bool);
 struct page *find_data_page(struct inode *, pgoff_t);
 struct page *get_lock_data_page(struct inode *, pgoff_t, bool);
 struct page *get_new_data_page(struct inode *, struct page *, pgoff_t, bool);
+int do_write_data_page_dnode(struct f2fs_io_info *, struct dnode_of_data *);
 int do_write_data_page(struct f2fs_io_info *);
 int f2fs_map_blocks(struct inode *, struct f2fs_map_blocks *, int, int);
 int f2fs_fiemap(struct inode *inode, struct fiemap_extent_info *, u64, u64);
@@ -1974,8 +2032,11 @@ struct f2fs_stat_info {
 	unsigned int bimodal, avg_vblocks;
 	int util_free, util_valid, util_invalid;
 	int rsvd_segs, overp_segs;
+	unsigned int discard_pending;
+	unsigned long long discard_cmds, discard_blks;
 	int dirty_count, node_pages, meta_pages;
 	int prefree_count, call_count, cp_count, bg_cp_count;
+	unsigned long long cp_block_time, cp_block_max;	/* in usec */
 	int tot_segs, node_segs, data_segs, free_segs, free_secs;
 	int bg_node_segs, bg_data_segs;
 	int tot_blks, data_blks, node_blks;
@@ -1997,6 +2058,13 @@ static inline struct f2fs_stat_info *F2FS_STAT(struct f2fs_sb_info *sbi)
 
 #define stat_inc_cp_count(si)		((si)->cp_count++)
 #define stat_inc_bg_cp_count(si)	((si)->bg_cp_count++)
+#define stat_add_cp_block_time(si, us)					\
+	do {								\
+		unsigned long long __us = (us);				\
+		(si)->cp_block_time += __us;				\
+		if (__us > (si)->cp_block_max)				\
+			(si)->cp_block_max = __us;			\
+	} while (0)
 #define stat_inc_call_count(si)		((si)->call_count++)
 #define stat_inc_bggc_count(sbi)	((sbi)->bg_gc++)
 #define stat_inc_dirty_inode(sbi, type)	((sbi)->ndirty_inode[type]++)
@@ -2080,6 +2148,7 @@ void f2fs_destroy_root_stats(void);
 #else
 #define stat_inc_cp_count(si)
 #define stat_inc_bg_cp_count(si)
+#define stat_add_cp_block_time(si, us)	((void)(us))
 #define stat_inc_call_count(si)
 #define stat_inc_bggc_count(si)
 #define stat_inc_dirty_inode(sbi, type)
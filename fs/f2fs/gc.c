@@ -257,6 +257,57 @@ static unsigned int count_bits(const unsigned long *addr,
 	return sum;
 }
 
+/*
+ * Cleaning takes its victim from the victim index rather than scanning the
+ * dirty segmap. Greedy wants the first usable section of the lowest bucket.
+ * Cost-benefit only needs the oldest usable section of each bucket, since
+ * sections of equal utilization differ in cost by their age alone.
+ */
+static void get_victim_from_index(struct f2fs_sb_info *sbi,
+			struct victim_sel_policy *p, int gc_type)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct victim_index *vi = &dirty_i->victim_index;
+	unsigned int nsearched = 0;
+	unsigned int vblocks;
+
+	for_each_set_bit(vblocks, vi->bucket_map, vi->nr_buckets) {
+		struct victim_entry *ve, *tmp;
+
+		list_for_each_entry_safe(ve, tmp, &vi->buckets[vblocks], list) {
+			unsigned int secno = ve - vi->entries;
+			unsigned int segno = secno * sbi->segs_per_sec;
+			unsigned int cost;
+
+			if (nsearched++ >= p->max_search)
+				return;
+
+			if (sec_usage_check(sbi, secno))
+				continue;
+			if (gc_type == BG_GC &&
+					test_bit(secno, dirty_i->victim_secmap))
+				continue;
+
+			/* blocks changed in a segment that was current */
+			if (get_valid_blocks(sbi, segno, sbi->segs_per_sec) !=
+								vblocks) {
+				queue_victim_entry(sbi, secno);
+				continue;
+			}
+
+			cost = get_gc_cost(sbi, segno, p);
+			if (p->min_cost > cost) {
+				p->min_segno = segno;
+				p->min_cost = cost;
+			}
+			break;
+		}
+
+		if (p->gc_mode == GC_GREEDY && p->min_segno != NULL_SEGNO)
+			return;
+	}
+}
+
 /*
  * This function is called from two paths.
  * One is garbage collection and the other is SSR segment selection.
@@ -285,13 +336,16 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 	if (p.max_search == 0)
 		goto out;
 
-	last_victim = sbi->last_victim[p.gc_mode];
-	if (p.alloc_mode == LFS && gc_type == FG_GC) {
-		p.min_segno = check_bg_victims(sbi);
-		if (p.min_segno != NULL_SEGNO)
-			goto got_it;
+	if (p.alloc_mode == LFS) {
+		if (gc_type == FG_GC)
+			p.min_segno = check_bg_victims(sbi);
+		if (p.min_segno == NULL_SEGNO)
+			get_victim_from_index(sbi, &p, gc_type);
+		goto got_it;
 	}
 
+	last_victim = sbi->last_victim[p.gc_mode];
+
 	while (1) {
 		unsigned long cost;
 		unsigned int segno;
@@ -340,8 +394,8 @@ next:
 			break;
 		}
 	}
-	if (p.min_segno != NULL_SEGNO) {
 got_it:
+	if (p.min_segno != NULL_SEGNO) {
 		if (p.alloc_mode == LFS) {
 			secno = GET_SECNO(sbi, p.min_segno);
 			if (gc_type == FG_GC)
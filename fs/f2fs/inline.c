@@ -296,7 +296,7 @@ struct f2fs_dir_entry *find_in_inline_dir(struct inode *dir,
 	inline_dentry = inline_data_addr(ipage);
 
 	make_dentry_ptr(NULL, &d, (void *)inline_dentry, 2);
-	de = find_target_dentry(fname, namehash, NULL, &d);
+	de = find_target_dentry(fname, namehash, NULL, NULL, &d);
 	unlock_page(ipage);
 	if (de)
 		*res_page = ipage;
@@ -1662,6 +1662,46 @@ static void __del_from_free_nid_list(struct f2fs_nm_info *nm_i,
 	radix_tree_delete(&nm_i->free_nid_root, i->nid);
 }
 
+static unsigned long *__free_nid_bits(struct f2fs_nm_info *nm_i,
+						unsigned int nat_ofs)
+{
+	return nm_i->free_nid_bitmap + nat_ofs * NAT_ENTRY_BITMAP_LONGS;
+}
+
+/*
+ * A set bit means the nid was free in the nat block or the journal when we
+ * saw it last and has not been handed out by alloc_nid() since.  It is only
+ * a hint: add_free_nid() still filters the nids which are in use.
+ * free_nid_list_lock should be held.
+ */
+static void __update_free_nid_bitmap(struct f2fs_nm_info *nm_i, nid_t nid,
+								bool free)
+{
+	unsigned int nat_ofs = NAT_BLOCK_OFFSET(nid);
+	unsigned int nid_ofs = nid - START_NID(nid);
+	unsigned long *bits;
+
+	if (!test_bit(nat_ofs, nm_i->nat_block_bitmap))
+		return;
+
+	bits = __free_nid_bits(nm_i, nat_ofs);
+	if (free) {
+		if (!__test_and_set_bit(nid_ofs, bits))
+			nm_i->free_nid_count[nat_ofs]++;
+	} else {
+		if (__test_and_clear_bit(nid_ofs, bits))
+			nm_i->free_nid_count[nat_ofs]--;
+	}
+}
+
+static void update_free_nid_bitmap(struct f2fs_nm_info *nm_i, nid_t nid,
+								bool free)
+{
+	spin_lock(&nm_i->free_nid_list_lock);
+	__update_free_nid_bitmap(nm_i, nid, free);
+	spin_unlock(&nm_i->free_nid_list_lock);
+}
+
 static int add_free_nid(struct f2fs_sb_info *sbi, nid_t nid, bool build)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
@@ -1721,29 +1761,48 @@ static void remove_free_nid(struct f2fs_nm_info *nm_i, nid_t nid)
 		nm_i->fcnt--;
 		need_free = true;
 	}
+	__update_free_nid_bitmap(nm_i, nid, false);
 	spin_unlock(&nm_i->free_nid_list_lock);
 
 	if (need_free)
 		kmem_cache_free(free_nid_slab, i);
 }
 
+/*
+ * Record the free nids of a whole nat block in its bitmap and add them to
+ * the free nid list.  From now on the bitmap is kept up to date, so that
+ * the block never needs to be read again to find free nids.
+ */
 static void scan_nat_page(struct f2fs_sb_info *sbi,
 			struct page *nat_page, nid_t start_nid)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	struct f2fs_nat_block *nat_blk = page_address(nat_page);
+	unsigned int nat_ofs = NAT_BLOCK_OFFSET(start_nid);
 	block_t blk_addr;
 	int i;
 
-	i = start_nid % NAT_ENTRY_PER_BLOCK;
+	start_nid = START_NID(start_nid);
+
+	spin_lock(&nm_i->free_nid_list_lock);
+	__set_bit(nat_ofs, nm_i->nat_block_bitmap);
+	for (i = 0; i < NAT_ENTRY_PER_BLOCK; i++) {
+		if (unlikely(start_nid + i >= nm_i->max_nid))
+			break;
+
+		blk_addr = le32_to_cpu(nat_blk->entries[i].block_addr);
+		f2fs_bug_on(sbi, blk_addr == NEW_ADDR);
+		if (blk_addr == NULL_ADDR)
+			__update_free_nid_bitmap(nm_i, start_nid + i, true);
+	}
+	spin_unlock(&nm_i->free_nid_list_lock);
 
-	for (; i < NAT_ENTRY_PER_BLOCK; i++, start_nid++) {
+	for (i = 0; i < NAT_ENTRY_PER_BLOCK; i++, start_nid++) {
 
 		if (unlikely(start_nid >= nm_i->max_nid))
 			break;
 
 		blk_addr = le32_to_cpu(nat_blk->entries[i].block_addr);
-		f2fs_bug_on(sbi, blk_addr == NEW_ADDR);
 		if (blk_addr == NULL_ADDR) {
 			if (add_free_nid(sbi, start_nid, true) < 0)
 				break;
@@ -1751,6 +1810,34 @@ static void scan_nat_page(struct f2fs_sb_info *sbi,
 	}
 }
 
+/*
+ * Refill the free nid list from the bitmaps of the nat blocks scanned so
+ * far, which needs no I/O.
+ */
+static void scan_free_nid_bits(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	unsigned int nat_ofs, idx;
+
+	down_read(&nm_i->nat_tree_lock);
+	for_each_set_bit(nat_ofs, nm_i->nat_block_bitmap, nm_i->nat_blocks) {
+		if (!nm_i->free_nid_count[nat_ofs])
+			continue;
+
+		for_each_set_bit(idx, __free_nid_bits(nm_i, nat_ofs),
+							NAT_ENTRY_PER_BLOCK) {
+			nid_t nid = nat_ofs * NAT_ENTRY_PER_BLOCK + idx;
+
+			if (add_free_nid(sbi, nid, true) < 0)
+				goto out;
+			if (nm_i->fcnt >= MAX_FREE_NIDS)
+				goto out;
+		}
+	}
+out:
+	up_read(&nm_i->nat_tree_lock);
+}
+
 static void build_free_nids(struct f2fs_sb_info *sbi)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
@@ -1763,17 +1850,25 @@ static void build_free_nids(struct f2fs_sb_info *sbi)
 	if (nm_i->fcnt > NAT_ENTRY_PER_BLOCK)
 		return;
 
+	/* try the nat blocks which were already scanned first */
+	scan_free_nid_bits(sbi);
+	if (nm_i->fcnt > NAT_ENTRY_PER_BLOCK)
+		return;
+
 	/* readahead nat pages to be scanned */
-	ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nid), FREE_NID_PAGES,
+	if (!test_bit(NAT_BLOCK_OFFSET(nid), nm_i->nat_block_bitmap))
+		ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nid), FREE_NID_PAGES,
 							META_NAT, true);
 
 	down_read(&nm_i->nat_tree_lock);
 
 	while (1) {
-		struct page *page = get_current_nat_page(sbi, nid);
+		if (!test_bit(NAT_BLOCK_OFFSET(nid), nm_i->nat_block_bitmap)) {
+			struct page *page = get_current_nat_page(sbi, nid);
 
-		scan_nat_page(sbi, page, nid);
-		f2fs_put_page(page, 1);
+			scan_nat_page(sbi, page, nid);
+			f2fs_put_page(page, 1);
+		}
 
 		nid += (NAT_ENTRY_PER_BLOCK - (nid % NAT_ENTRY_PER_BLOCK));
 		if (unlikely(nid >= nm_i->max_nid))
@@ -1793,15 +1888,19 @@ static void build_free_nids(struct f2fs_sb_info *sbi)
 
 		addr = le32_to_cpu(nat_in_journal(journal, i).block_addr);
 		nid = le32_to_cpu(nid_in_journal(journal, i));
-		if (addr == NULL_ADDR)
+		if (addr == NULL_ADDR) {
+			update_free_nid_bitmap(nm_i, nid, true);
 			add_free_nid(sbi, nid, true);
-		else
+		} else {
 			remove_free_nid(nm_i, nid);
+		}
 	}
 	up_read(&curseg->journal_rwsem);
 	up_read(&nm_i->nat_tree_lock);
 
-	ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
+	if (!test_bit(NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
+					nm_i->nat_block_bitmap))
+		ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
 					nm_i->ra_nid_pages, META_NAT, false);
 }
 
@@ -1831,6 +1930,7 @@ retry:
 		*nid = i->nid;
 		i->state = NID_ALLOC;
 		nm_i->fcnt--;
+		__update_free_nid_bitmap(nm_i, i->nid, false);
 		spin_unlock(&nm_i->free_nid_list_lock);
 		return true;
 	}
@@ -1882,6 +1982,7 @@ void alloc_nid_failed(struct f2fs_sb_info *sbi, nid_t nid)
 		i->state = NID_NEW;
 		nm_i->fcnt++;
 	}
+	__update_free_nid_bitmap(nm_i, nid, true);
 	spin_unlock(&nm_i->free_nid_list_lock);
 
 	if (need_free)
@@ -2150,6 +2251,8 @@ static void __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 		raw_nat_from_node_info(raw_ne, &ne->ni);
 		nat_reset_flag(ne);
 		__clear_nat_cache_dirty(NM_I(sbi), ne);
+		update_free_nid_bitmap(NM_I(sbi), nid,
+					nat_get_blkaddr(ne) == NULL_ADDR);
 		if (nat_get_blkaddr(ne) == NULL_ADDR)
 			add_free_nid(sbi, nid, false);
 	}
@@ -2224,6 +2327,7 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	nat_blocks = nat_segs << le32_to_cpu(sb_raw->log_blocks_per_seg);
 
 	nm_i->max_nid = NAT_ENTRY_PER_BLOCK * nat_blocks;
+	nm_i->nat_blocks = nat_blocks;
 
 	/* not used nids: 0, node, meta, (and root counted as valid node) */
 	nm_i->available_nids = nm_i->max_nid - F2FS_RESERVED_NODE_NUM;
@@ -2256,6 +2360,28 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+static int init_free_nid_cache(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+
+	nm_i->nat_block_bitmap = f2fs_kvzalloc(
+			BITS_TO_LONGS(nm_i->nat_blocks) * sizeof(long),
+			GFP_KERNEL);
+	if (!nm_i->nat_block_bitmap)
+		return -ENOMEM;
+
+	nm_i->free_nid_bitmap = f2fs_kvzalloc(nm_i->nat_blocks *
+			NAT_ENTRY_BITMAP_LONGS * sizeof(long), GFP_KERNEL);
+	if (!nm_i->free_nid_bitmap)
+		return -ENOMEM;
+
+	nm_i->free_nid_count = f2fs_kvzalloc(nm_i->nat_blocks *
+			sizeof(unsigned short), GFP_KERNEL);
+	if (!nm_i->free_nid_count)
+		return -ENOMEM;
+	return 0;
+}
+
 int build_node_manager(struct f2fs_sb_info *sbi)
 {
 	int err;
@@ -2268,6 +2394,10 @@ int build_node_manager(struct f2fs_sb_info *sbi)
 	if (err)
 		return err;
 
+	err = init_free_nid_cache(sbi);
+	if (err)
+		return err;
+
 	build_free_nids(sbi);
 	return 0;
 }
@@ -2325,6 +2455,10 @@ void destroy_node_manager(struct f2fs_sb_info *sbi)
 	}
 	up_write(&nm_i->nat_tree_lock);
 
+	f2fs_kvfree(nm_i->nat_block_bitmap);
+	f2fs_kvfree(nm_i->free_nid_bitmap);
+	f2fs_kvfree(nm_i->free_nid_count);
+
 	kfree(nm_i->nat_bitmap);
 	sbi->nm_info = NULL;
 	kfree(nm_i);
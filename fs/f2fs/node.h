@@ -17,6 +17,12 @@
 /* # of pages to perform synchronous readahead before building free nids */
 #define FREE_NID_PAGES 4
 
+/* # of free nids to gather from the free nid bitmap at once */
+#define MAX_FREE_NIDS	(NAT_ENTRY_PER_BLOCK * FREE_NID_PAGES)
+
+/* size of the in-memory free nid bitmap of a nat block */
+#define NAT_ENTRY_BITMAP_LONGS	BITS_TO_LONGS(NAT_ENTRY_PER_BLOCK)
+
 #define DEF_RA_NID_PAGES	4	/* # of nid pages to be readaheaded */
 
 /* maximum readahead size for node during getting data blocks */
@@ -14,8 +14,10 @@
 #include <linux/blkdev.h>
 #include <linux/prefetch.h>
 #include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <linux/swap.h>
 #include <linux/timer.h>
+#include <linux/list_sort.h>
 
 #include "f2fs.h"
 #include "segment.h"
@@ -26,6 +28,7 @@
 #define __reverse_ffz(x) __reverse_ffs(~(x))
 
 static struct kmem_cache *discard_entry_slab;
+static struct kmem_cache *discard_range_slab;
 static struct kmem_cache *sit_entry_set_slab;
 static struct kmem_cache *inmem_entry_slab;
 
@@ -305,6 +308,20 @@ void drop_inmem_pages(struct inode *inode)
 	mutex_unlock(&fi->inmem_lock);
 }
 
+static int inmem_page_cmp(void *priv, struct list_head *a,
+						struct list_head *b)
+{
+	pgoff_t ia = list_entry(a, struct inmem_pages, list)->page->index;
+	pgoff_t ib = list_entry(b, struct inmem_pages, list)->page->index;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+/*
+ * Pages are committed in file order, so that a run of pages mapped by the
+ * same node block shares one dnode lookup and one node page update. Their
+ * data blocks all go through the merged DATA bio and are submitted once.
+ */
 static int __commit_inmem_pages(struct inode *inode,
 					struct list_head *revoke_list)
 {
@@ -317,13 +334,30 @@ static int __commit_inmem_pages(struct inode *inode,
 		.rw = WRITE_SYNC | REQ_PRIO,
 		.encrypted_page = NULL,
 	};
+	struct dnode_of_data dn;
+	pgoff_t dn_start = 0, dn_end = 0;
+	bool dn_locked = false;
 	bool submit_bio = false;
 	int err = 0;
 
+	list_sort(NULL, &fi->inmem_pages, inmem_page_cmp);
+
 	list_for_each_entry_safe(cur, tmp, &fi->inmem_pages, list) {
 		struct page *page = cur->page;
 
-		lock_page(page);
+		/*
+		 * The node page of the previous page stays locked while the
+		 * next pages fall within it. Under it, data pages are only
+		 * trylocked, as the usual order is data page, then node page.
+		 */
+		if (dn_locked && (page->index < dn_start ||
+				page->index >= dn_end || !trylock_page(page))) {
+			f2fs_put_dnode(&dn);
+			dn_locked = false;
+		}
+		if (!dn_locked)
+			lock_page(page);
+
 		if (page->mapping == inode->i_mapping) {
 			trace_f2fs_commit_inmem_page(page, INMEM);
 
@@ -332,8 +366,26 @@ static int __commit_inmem_pages(struct inode *inode,
 			if (clear_page_dirty_for_io(page))
 				inode_dec_dirty_pages(inode);
 
+			if (!dn_locked) {
+				set_new_dnode(&dn, inode, NULL, NULL, 0);
+				err = get_dnode_of_data(&dn, page->index,
+								LOOKUP_NODE);
+				if (err) {
+					unlock_page(page);
+					break;
+				}
+				dn_locked = true;
+				dn_start = page->index - dn.ofs_in_node;
+				dn_end = dn_start +
+					ADDRS_PER_PAGE(dn.node_page, inode);
+			} else {
+				dn.ofs_in_node = page->index - dn_start;
+				dn.data_blkaddr = datablock_addr(dn.node_page,
+								dn.ofs_in_node);
+			}
+
 			fio.page = page;
-			err = do_write_data_page(&fio);
+			err = do_write_data_page_dnode(&fio, &dn);
 			if (err) {
 				unlock_page(page);
 				break;
@@ -349,6 +401,9 @@ static int __commit_inmem_pages(struct inode *inode,
 		list_move_tail(&cur->list, revoke_list);
 	}
 
+	if (dn_locked)
+		f2fs_put_dnode(&dn);
+
 	if (submit_bio)
 		f2fs_submit_merged_bio_cond(sbi, inode, NULL, 0, DATA, WRITE);
 
@@ -582,9 +637,17 @@ static void __locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 	if (IS_CURSEG(sbi, segno))
 		return;
 
-	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]++;
 
+		if (dirty_type == DIRTY) {
+			unsigned int secno = GET_SECNO(sbi, segno);
+
+			if (!dirty_i->victim_index.entries[secno].nr_dirty++)
+				queue_victim_entry(sbi, secno);
+		}
+	}
+
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
 		enum dirty_type t = sentry->type;
@@ -603,9 +666,17 @@ static void __remove_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 
-	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]--;
 
+		if (dirty_type == DIRTY) {
+			unsigned int secno = GET_SECNO(sbi, segno);
+
+			if (!--dirty_i->victim_index.entries[secno].nr_dirty)
+				dequeue_victim_entry(sbi, secno);
+		}
+	}
+
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
 		enum dirty_type t = sentry->type;
@@ -646,14 +717,26 @@ static void locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno)
 		__remove_dirty_segment(sbi, segno, DIRTY);
 	}
 
+	/* follow the valid blocks update_sit_entry() has just changed */
+	if (dirty_i->victim_index.entries[GET_SECNO(sbi, segno)].nr_dirty)
+		queue_victim_entry(sbi, GET_SECNO(sbi, segno));
+
 	mutex_unlock(&dirty_i->seglist_lock);
 }
 
-static int f2fs_issue_discard(struct f2fs_sb_info *sbi,
+static int __f2fs_issue_discard(struct f2fs_sb_info *sbi,
 				block_t blkstart, block_t blklen)
 {
 	sector_t start = SECTOR_FROM_BLOCK(blkstart);
 	sector_t len = SECTOR_FROM_BLOCK(blklen);
+
+	trace_f2fs_issue_discard(sbi->sb, blkstart, blklen);
+	return blkdev_issue_discard(sbi->sb->s_bdev, start, len, GFP_NOFS, 0);
+}
+
+static void __mark_discarded(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
 	struct seg_entry *se;
 	unsigned int offset;
 	block_t i;
@@ -665,8 +748,372 @@ static int f2fs_issue_discard(struct f2fs_sb_info *sbi,
 		if (!f2fs_test_and_set_bit(offset, se->discard_map))
 			sbi->discard_blks--;
 	}
-	trace_f2fs_issue_discard(sbi->sb, blkstart, blklen);
-	return blkdev_issue_discard(sbi->sb->s_bdev, start, len, GFP_NOFS, 0);
+}
+
+static int f2fs_issue_discard(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
+	__mark_discarded(sbi, blkstart, blklen);
+	return __f2fs_issue_discard(sbi, blkstart, blklen);
+}
+
+/*
+ * Discards found by a checkpoint are only queued here, merged into a tree
+ * of pending ranges, and left to issue_discard_thread(). A range is marked
+ * discarded when it is queued; writing into a segment with pending ranges
+ * cancels them first, see f2fs_cancel_discard().
+ */
+static void f2fs_queue_discard(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct rb_node **p = &dcc->root.rb_node;
+	struct rb_node *parent = NULL, *node;
+	struct discard_range *dr, *new;
+	block_t blkend = blkstart + blklen;
+	unsigned int segno;
+
+	__mark_discarded(sbi, blkstart, blklen);
+
+	new = f2fs_kmem_cache_alloc(discard_range_slab, GFP_NOFS);
+
+	spin_lock(&dcc->discard_lock);
+
+	for (segno = GET_SEGNO(sbi, blkstart);
+			segno <= GET_SEGNO(sbi, blkend - 1); segno++)
+		set_bit(segno, dcc->pending_segmap);
+
+	while (*p) {
+		parent = *p;
+		dr = rb_entry(parent, struct discard_range, rb_node);
+
+		if (blkend < dr->blkaddr) {
+			p = &(*p)->rb_left;
+		} else if (blkstart > dr->blkaddr + dr->len) {
+			p = &(*p)->rb_right;
+		} else {
+			/* touching or overlapping: grow this range instead */
+			blkstart = min(blkstart, dr->blkaddr);
+			blkend = max(blkend, dr->blkaddr + dr->len);
+			dcc->pending_blks -= dr->len;
+			goto merge;
+		}
+	}
+
+	new->blkaddr = blkstart;
+	new->len = blklen;
+	rb_link_node(&new->rb_node, parent, p);
+	rb_insert_color(&new->rb_node, &dcc->root);
+	dcc->nr_ranges++;
+	dcc->pending_blks += blklen;
+	new = NULL;
+	goto out;
+
+merge:
+	/* absorb the ranges the grown one now reaches on either side */
+	while ((node = rb_prev(&dr->rb_node))) {
+		struct discard_range *prev = rb_entry(node,
+					struct discard_range, rb_node);
+
+		if (prev->blkaddr + prev->len < blkstart)
+			break;
+		blkstart = min(blkstart, prev->blkaddr);
+		dcc->pending_blks -= prev->len;
+		rb_erase(node, &dcc->root);
+		dcc->nr_ranges--;
+		kmem_cache_free(discard_range_slab, prev);
+	}
+	while ((node = rb_next(&dr->rb_node))) {
+		struct discard_range *next = rb_entry(node,
+					struct discard_range, rb_node);
+
+		if (next->blkaddr > blkend)
+			break;
+		blkend = max(blkend, next->blkaddr + next->len);
+		dcc->pending_blks -= next->len;
+		rb_erase(node, &dcc->root);
+		dcc->nr_ranges--;
+		kmem_cache_free(discard_range_slab, next);
+	}
+	dr->blkaddr = blkstart;
+	dr->len = blkend - blkstart;
+	dcc->pending_blks += dr->len;
+out:
+	spin_unlock(&dcc->discard_lock);
+
+	if (new)
+		kmem_cache_free(discard_range_slab, new);
+	else
+		wake_up_interruptible(&dcc->discard_wait_queue);
+}
+
+static bool discard_in_flight(struct discard_cmd_control *dcc,
+				block_t blkstart, block_t blkend)
+{
+	bool ret;
+
+	spin_lock(&dcc->discard_lock);
+	ret = dcc->issue_len && dcc->issue_blkaddr < blkend &&
+			dcc->issue_blkaddr + dcc->issue_len > blkstart;
+	spin_unlock(&dcc->discard_lock);
+	return ret;
+}
+
+static void __cancel_discard(struct f2fs_sb_info *sbi,
+		struct discard_cmd_control *dcc, unsigned int segno)
+{
+	struct seg_entry *se = get_seg_entry(sbi, segno);
+	block_t blkstart = START_BLOCK(sbi, segno);
+	block_t blkend = blkstart + sbi->blocks_per_seg;
+	struct discard_range *dr, *new;
+	struct rb_node *node;
+	char cancelled[SIT_VBLOCK_MAP_SIZE] = { 0 };
+	unsigned int offset;
+	block_t blk;
+
+	new = f2fs_kmem_cache_alloc(discard_range_slab, GFP_NOFS);
+
+	spin_lock(&dcc->discard_lock);
+
+	/* find the first range ending past blkstart */
+	node = dcc->root.rb_node;
+	dr = NULL;
+	while (node) {
+		struct discard_range *this = rb_entry(node,
+					struct discard_range, rb_node);
+
+		if (this->blkaddr + this->len > blkstart) {
+			dr = this;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	while (dr && dr->blkaddr < blkend) {
+		block_t dr_end = dr->blkaddr + dr->len;
+
+		node = rb_next(&dr->rb_node);
+
+		/* remember the blocks of the segment taken off this range */
+		for (blk = max(dr->blkaddr, blkstart);
+				blk < min(dr_end, blkend); blk++)
+			f2fs_set_bit(blk - blkstart, cancelled);
+
+		if (dr->blkaddr < blkstart && dr_end > blkend) {
+			/* the segment sits inside: split the range */
+			dr->len = blkstart - dr->blkaddr;
+			new->blkaddr = blkend;
+			new->len = dr_end - blkend;
+			/* link it in right after dr */
+			if (!dr->rb_node.rb_right)
+				rb_link_node(&new->rb_node, &dr->rb_node,
+						&dr->rb_node.rb_right);
+			else
+				rb_link_node(&new->rb_node, node,
+						&node->rb_left);
+			rb_insert_color(&new->rb_node, &dcc->root);
+			dcc->nr_ranges++;
+			dcc->pending_blks -= sbi->blocks_per_seg;
+			new = NULL;
+		} else if (dr->blkaddr < blkstart) {
+			dcc->pending_blks -= dr_end - blkstart;
+			dr->len = blkstart - dr->blkaddr;
+		} else if (dr_end > blkend) {
+			dcc->pending_blks -= blkend - dr->blkaddr;
+			dr->len = dr_end - blkend;
+			dr->blkaddr = blkend;
+		} else {
+			dcc->pending_blks -= dr->len;
+			rb_erase(&dr->rb_node, &dcc->root);
+			dcc->nr_ranges--;
+			kmem_cache_free(discard_range_slab, dr);
+		}
+
+		dr = node ? rb_entry(node, struct discard_range, rb_node) :
+									NULL;
+	}
+	clear_bit(segno, dcc->pending_segmap);
+
+	spin_unlock(&dcc->discard_lock);
+
+	if (new)
+		kmem_cache_free(discard_range_slab, new);
+
+	/*
+	 * The blocks we took back were marked discarded when queued. Other
+	 * invalid blocks of the segment may have been discarded already by
+	 * an earlier checkpoint, so leave those alone.
+	 */
+	for (offset = 0; offset < sbi->blocks_per_seg; offset++) {
+		if (!f2fs_test_bit(offset, cancelled) ||
+				f2fs_test_bit(offset, se->cur_valid_map))
+			continue;
+		if (f2fs_test_and_clear_bit(offset, se->discard_map))
+			sbi->discard_blks++;
+	}
+
+	wait_event(dcc->discard_done_queue,
+			!discard_in_flight(dcc, blkstart, blkend));
+}
+
+/*
+ * Blocks are about to be written in @segno: drop the discards still queued
+ * for the segment and wait for one the thread may be issuing.
+ */
+static void f2fs_cancel_discard(struct f2fs_sb_info *sbi, unsigned int segno)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	if (dcc && test_bit(segno, dcc->pending_segmap))
+		__cancel_discard(sbi, dcc, segno);
+}
+
+static void f2fs_discard_blocks(struct f2fs_sb_info *sbi,
+		struct cp_control *cpc, block_t blkstart, block_t blklen)
+{
+	/* trimming wants its discards issued by the time it returns */
+	if (cpc->reason != CP_DISCARD && SM_I(sbi)->dcc_info)
+		f2fs_queue_discard(sbi, blkstart, blklen);
+	else
+		f2fs_issue_discard(sbi, blkstart, blklen);
+}
+
+/*
+ * Take the next chunk of at most a segment off the tree and issue it.
+ * Returns the number of blocks issued, 0 once the tree is empty.
+ */
+static block_t issue_discard_chunk(struct f2fs_sb_info *sbi,
+					struct discard_cmd_control *dcc)
+{
+	struct discard_range *dr;
+	struct rb_node *node;
+	block_t blkaddr, len;
+
+	spin_lock(&dcc->discard_lock);
+	node = rb_first(&dcc->root);
+	if (!node) {
+		spin_unlock(&dcc->discard_lock);
+		return 0;
+	}
+	dr = rb_entry(node, struct discard_range, rb_node);
+	blkaddr = dr->blkaddr;
+	len = min_t(block_t, dr->len, sbi->blocks_per_seg);
+	dr->blkaddr += len;
+	dr->len -= len;
+	if (!dr->len) {
+		rb_erase(node, &dcc->root);
+		dcc->nr_ranges--;
+		kmem_cache_free(discard_range_slab, dr);
+	}
+	dcc->pending_blks -= len;
+	dcc->issue_blkaddr = blkaddr;
+	dcc->issue_len = len;
+	spin_unlock(&dcc->discard_lock);
+
+	__f2fs_issue_discard(sbi, blkaddr, len);
+
+	spin_lock(&dcc->discard_lock);
+	dcc->issue_len = 0;
+	dcc->issued_cmds++;
+	dcc->issued_blks += len;
+	spin_unlock(&dcc->discard_lock);
+	wake_up_all(&dcc->discard_done_queue);
+
+	return len;
+}
+
+static bool discard_bdev_idle(struct f2fs_sb_info *sbi)
+{
+	struct request_queue *q = bdev_get_queue(sbi->sb->s_bdev);
+	struct request_list *rl = &q->rq;
+
+	return !rl->count[BLK_RW_SYNC] && !rl->count[BLK_RW_ASYNC];
+}
+
+static int issue_discard_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	wait_queue_head_t *q = &dcc->discard_wait_queue;
+
+	do {
+		unsigned int issued = 0;
+		block_t len;
+
+		if (try_to_freeze())
+			continue;
+		else if (!dcc->pending_blks)
+			wait_event_interruptible(*q, kthread_should_stop() ||
+					dcc->pending_blks || freezing(current));
+		else
+			wait_event_interruptible_timeout(*q,
+				kthread_should_stop() || freezing(current),
+				msecs_to_jiffies(
+					SM_I(sbi)->discard_issue_interval));
+		if (kthread_should_stop())
+			break;
+
+		/* leave the device to foreground I/O */
+		if (!discard_bdev_idle(sbi))
+			continue;
+
+		while (issued < SM_I(sbi)->max_discard_issue &&
+				(len = issue_discard_chunk(sbi, dcc)))
+			issued += len;
+	} while (!kthread_should_stop());
+	return 0;
+}
+
+int create_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct discard_cmd_control *dcc;
+	int err = 0;
+
+	dcc = kzalloc(sizeof(struct discard_cmd_control), GFP_KERNEL);
+	if (!dcc)
+		return -ENOMEM;
+	dcc->pending_segmap = f2fs_kvzalloc(f2fs_bitmap_size(MAIN_SEGS(sbi)),
+								GFP_KERNEL);
+	if (!dcc->pending_segmap) {
+		kfree(dcc);
+		return -ENOMEM;
+	}
+	init_waitqueue_head(&dcc->discard_wait_queue);
+	init_waitqueue_head(&dcc->discard_done_queue);
+	spin_lock_init(&dcc->discard_lock);
+	dcc->root = RB_ROOT;
+	SM_I(sbi)->dcc_info = dcc;
+	dcc->f2fs_issue_discard = kthread_run(issue_discard_thread, sbi,
+				"f2fs_discard-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(dcc->f2fs_issue_discard)) {
+		err = PTR_ERR(dcc->f2fs_issue_discard);
+		f2fs_kvfree(dcc->pending_segmap);
+		kfree(dcc);
+		SM_I(sbi)->dcc_info = NULL;
+		return err;
+	}
+
+	return err;
+}
+
+void destroy_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	if (!dcc)
+		return;
+	if (dcc->f2fs_issue_discard)
+		kthread_stop(dcc->f2fs_issue_discard);
+
+	/* what the checkpoint queued is still owed to the device */
+	while (issue_discard_chunk(sbi, dcc))
+		;
+
+	f2fs_kvfree(dcc->pending_segmap);
+	kfree(dcc);
+	SM_I(sbi)->dcc_info = NULL;
 }
 
 bool discard_next_dnode(struct f2fs_sb_info *sbi, block_t blkaddr)
@@ -678,6 +1125,9 @@ bool discard_next_dnode(struct f2fs_sb_info *sbi, block_t blkaddr)
 				GET_SEGNO(sbi, blkaddr));
 		unsigned int offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
 
+		/* a queued discard does not count, this one must happen now */
+		f2fs_cancel_discard(sbi, GET_SEGNO(sbi, blkaddr));
+
 		if (f2fs_test_bit(offset, se->discard_map))
 			return false;
 
@@ -805,7 +1255,7 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 		if (!test_opt(sbi, DISCARD))
 			continue;
 
-		f2fs_issue_discard(sbi, START_BLOCK(sbi, start),
+		f2fs_discard_blocks(sbi, cpc, START_BLOCK(sbi, start),
 				(end - start) << sbi->log_blocks_per_seg);
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
@@ -814,7 +1264,7 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	list_for_each_entry_safe(entry, this, head, list) {
 		if (cpc->reason == CP_DISCARD && entry->len < cpc->trim_minlen)
 			goto skip;
-		f2fs_issue_discard(sbi, entry->blkaddr, entry->len);
+		f2fs_discard_blocks(sbi, cpc, entry->blkaddr, entry->len);
 		cpc->trimmed += entry->len;
 skip:
 		list_del(&entry->list);
@@ -852,6 +1302,9 @@ static void update_sit_entry(struct f2fs_sb_info *sbi, block_t blkaddr, int del)
 
 	segno = GET_SEGNO(sbi, blkaddr);
 
+	if (del > 0)
+		f2fs_cancel_discard(sbi, segno);
+
 	se = get_seg_entry(sbi, segno);
 	new_vblocks = se->valid_blocks + del;
 	offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
@@ -2372,6 +2825,32 @@ static void init_dirty_segmap(struct f2fs_sb_info *sbi)
 	}
 }
 
+static int init_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	unsigned int i;
+
+	vi->nr_buckets = sbi->blocks_per_seg * sbi->segs_per_sec + 1;
+	vi->buckets = f2fs_kvmalloc(vi->nr_buckets * sizeof(struct list_head),
+								GFP_KERNEL);
+	if (!vi->buckets)
+		return -ENOMEM;
+	vi->bucket_map = f2fs_kvzalloc(f2fs_bitmap_size(vi->nr_buckets),
+								GFP_KERNEL);
+	if (!vi->bucket_map)
+		return -ENOMEM;
+	vi->entries = f2fs_kvzalloc(MAIN_SECS(sbi) *
+				sizeof(struct victim_entry), GFP_KERNEL);
+	if (!vi->entries)
+		return -ENOMEM;
+
+	for (i = 0; i < vi->nr_buckets; i++)
+		INIT_LIST_HEAD(&vi->buckets[i]);
+	for (i = 0; i < MAIN_SECS(sbi); i++)
+		INIT_LIST_HEAD(&vi->entries[i].list);
+	return 0;
+}
+
 static int init_victim_secmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
@@ -2404,6 +2883,9 @@ static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 			return -ENOMEM;
 	}
 
+	if (init_victim_index(sbi))
+		return -ENOMEM;
+
 	init_dirty_segmap(sbi);
 	return init_victim_secmap(sbi);
 }
@@ -2466,6 +2948,9 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	sm_info->nr_discards = 0;
 	sm_info->max_discards = 0;
 
+	sm_info->max_discard_issue = DEF_MAX_DISCARD_ISSUE;
+	sm_info->discard_issue_interval = DEF_DISCARD_ISSUE_INTERVAL;
+
 	sm_info->trim_sections = DEF_BATCHED_TRIM_SECTIONS;
 
 	INIT_LIST_HEAD(&sm_info->sit_entry_set);
@@ -2494,6 +2979,12 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	if (err)
 		return err;
 
+	if (test_opt(sbi, DISCARD) && !f2fs_readonly(sbi->sb)) {
+		err = create_discard_cmd_control(sbi);
+		if (err)
+			return err;
+	}
+
 	init_min_max_mtime(sbi);
 	return 0;
 }
@@ -2515,6 +3006,15 @@ static void destroy_victim_secmap(struct f2fs_sb_info *sbi)
 	f2fs_kvfree(dirty_i->victim_secmap);
 }
 
+static void destroy_victim_index(struct f2fs_sb_info *sbi)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+
+	f2fs_kvfree(vi->entries);
+	f2fs_kvfree(vi->bucket_map);
+	f2fs_kvfree(vi->buckets);
+}
+
 static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
@@ -2527,6 +3027,7 @@ static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 	for (i = 0; i < NR_DIRTY_TYPE; i++)
 		discard_dirty_segmap(sbi, i);
 
+	destroy_victim_index(sbi);
 	destroy_victim_secmap(sbi);
 	SM_I(sbi)->dirty_info = NULL;
 	kfree(dirty_i);
@@ -2591,6 +3092,7 @@ void destroy_segment_manager(struct f2fs_sb_info *sbi)
 	if (!sm_info)
 		return;
 	destroy_flush_cmd_control(sbi);
+	destroy_discard_cmd_control(sbi);
 	destroy_dirty_segmap(sbi);
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
@@ -2606,10 +3108,15 @@ int __init create_segment_manager_caches(void)
 	if (!discard_entry_slab)
 		goto fail;
 
+	discard_range_slab = f2fs_kmem_cache_create("discard_range",
+			sizeof(struct discard_range));
+	if (!discard_range_slab)
+		goto destory_discard_entry;
+
 	sit_entry_set_slab = f2fs_kmem_cache_create("sit_entry_set",
 			sizeof(struct sit_entry_set));
 	if (!sit_entry_set_slab)
-		goto destory_discard_entry;
+		goto destroy_discard_range;
 
 	inmem_entry_slab = f2fs_kmem_cache_create("inmem_page_entry",
 			sizeof(struct inmem_pages));
@@ -2619,6 +3126,8 @@ int __init create_segment_manager_caches(void)
 
 destroy_sit_entry_set:
 	kmem_cache_destroy(sit_entry_set_slab);
+destroy_discard_range:
+	kmem_cache_destroy(discard_range_slab);
 destory_discard_entry:
 	kmem_cache_destroy(discard_entry_slab);
 fail:
@@ -2628,6 +3137,7 @@ fail:
 void destroy_segment_manager_caches(void)
 {
 	kmem_cache_destroy(sit_entry_set_slab);
+	kmem_cache_destroy(discard_range_slab);
 	kmem_cache_destroy(discard_entry_slab);
 	kmem_cache_destroy(inmem_entry_slab);
 }
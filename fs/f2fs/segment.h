@@ -239,12 +239,32 @@ enum dirty_type {
 	NR_DIRTY_TYPE
 };
 
+/*
+ * Sections holding DIRTY segments, queued by their number of valid blocks
+ * so that cleaning need not scan the dirty segmap for a victim. Each
+ * bucket keeps its sections in the order they were last updated, oldest
+ * first.
+ */
+struct victim_entry {
+	struct list_head list;			/* link in a bucket */
+	unsigned int vblocks;			/* bucket the entry is on */
+	unsigned int nr_dirty;			/* # of DIRTY segments */
+};
+
+struct victim_index {
+	struct list_head *buckets;		/* indexed by valid blocks */
+	unsigned long *bucket_map;		/* non-empty buckets */
+	unsigned int nr_buckets;		/* blocks per section + 1 */
+	struct victim_entry *entries;		/* one per section */
+};
+
 struct dirty_seglist_info {
 	const struct victim_selection *v_ops;	/* victim selction operation */
 	unsigned long *dirty_segmap[NR_DIRTY_TYPE];
 	struct mutex seglist_lock;		/* lock for segment bitmaps */
 	int nr_dirty[NR_DIRTY_TYPE];		/* # of dirty segments */
 	unsigned long *victim_secmap;		/* background GC victims */
+	struct victim_index victim_index;	/* dirty sections by vblocks */
 };
 
 /* victim selection function for cleaning and SSR */
@@ -682,6 +702,36 @@ static inline bool sec_usage_check(struct f2fs_sb_info *sbi, unsigned int secno)
 	return false;
 }
 
+/*
+ * (Re)queue a section at the tail of the bucket for its current number of
+ * valid blocks. Called with seglist_lock held.
+ */
+static inline void queue_victim_entry(struct f2fs_sb_info *sbi,
+						unsigned int secno)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	struct victim_entry *ve = &vi->entries[secno];
+	unsigned int old = ve->vblocks;
+
+	ve->vblocks = get_valid_blocks(sbi, secno * sbi->segs_per_sec,
+							sbi->segs_per_sec);
+	list_move_tail(&ve->list, &vi->buckets[ve->vblocks]);
+	set_bit(ve->vblocks, vi->bucket_map);
+	if (old != ve->vblocks && list_empty(&vi->buckets[old]))
+		clear_bit(old, vi->bucket_map);
+}
+
+static inline void dequeue_victim_entry(struct f2fs_sb_info *sbi,
+						unsigned int secno)
+{
+	struct victim_index *vi = &DIRTY_I(sbi)->victim_index;
+	struct victim_entry *ve = &vi->entries[secno];
+
+	list_del_init(&ve->list);
+	if (list_empty(&vi->buckets[ve->vblocks]))
+		clear_bit(ve->vblocks, vi->bucket_map);
+}
+
 static inline unsigned int max_hw_blocks(struct f2fs_sb_info *sbi)
 {
 	struct block_device *bdev = sbi->sb->s_bdev;
@@ -74,6 +74,9 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, struct nameidata *nd)
 		goto out;
 	}
 
+	/* catch up with package list changes since the last lookup */
+	revalidate_derived_permission(dentry);
+
 	if (dentry < lower_dentry) {
 		spin_lock(&dentry->d_lock);
 		spin_lock(&lower_dentry->d_lock);
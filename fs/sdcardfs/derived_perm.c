@@ -54,6 +54,11 @@ void get_derived_permission_new(struct dentry *parent, struct dentry *dentry, st
 	struct sdcardfs_inode_info *parent_info= SDCARDFS_I(parent->d_inode);
 	appid_t appid;
 
+	/* read the generation first, so that a concurrent package list
+	 * change leaves us stale rather than wrongly up to date */
+	info->data_gen = atomic_read(&sdcardfs_pkgl_generation);
+	smp_rmb();
+
 	/* By default, each inode inherits from its parent.
 	 * the properties are maintained on its private fields
 	 * because the inode attributes will be modified with that of
@@ -117,12 +122,6 @@ void get_derived_permission(struct dentry *parent, struct dentry *dentry)
 	get_derived_permission_new(parent, dentry, dentry);
 }
 
-static int descendant_may_need_fixup(perm_t perm) {
-	if (perm == PERM_PRE_ROOT || perm == PERM_ROOT || perm == PERM_ANDROID)
-		return 1;
-	return 0;
-}
-
 static int needs_fixup(perm_t perm) {
 	if (perm == PERM_ANDROID_DATA || perm == PERM_ANDROID_OBB
 			|| perm == PERM_ANDROID_MEDIA)
@@ -130,31 +129,39 @@ static int needs_fixup(perm_t perm) {
 	return 0;
 }
 
-void fixup_perms_recursive(struct dentry *dentry, const char* name, size_t len) {
-	struct dentry *child;
+/*
+ * A package list change only bumps sdcardfs_pkgl_generation. The derived
+ * state of an inode is stamped with the generation it was computed at, and
+ * stale inodes are brought up to date here the next time they are looked
+ * up or checked for permission, instead of walking every cached dentry of
+ * every mount on each change.
+ *
+ * Only the per-package directories right below Android/{data,obb,media}
+ * take their owner from the package list; everything below them follows
+ * their top inode in sdcardfs_permission().
+ */
+void revalidate_derived_permission(struct dentry *dentry)
+{
 	struct sdcardfs_inode_info *info;
-	if (!dentry || !dentry->d_inode)
+	struct dentry *parent;
+	int gen;
+
+	if (!dentry->d_inode)
 		return;
 	info = SDCARDFS_I(dentry->d_inode);
+	gen = atomic_read(&sdcardfs_pkgl_generation);
+	if (info->data_gen == gen)
+		return;
 
-	if (needs_fixup(info->perm)) {
-		mutex_lock(&dentry->d_inode->i_mutex);
-		child = lookup_one_len(name, dentry, len);
-		mutex_unlock(&dentry->d_inode->i_mutex);
-		if (!IS_ERR(child)) {
-			if (child->d_inode) {
-				get_derived_permission(dentry, child);
-				fix_derived_permission(child->d_inode);
-			}
-			dput(child);
-		}
-	} else 	if (descendant_may_need_fixup(info->perm)) {
-		mutex_lock(&dentry->d_inode->i_mutex);
-		list_for_each_entry(child, &dentry->d_subdirs, d_child) {
-				fixup_perms_recursive(child, name, len);
-		}
-		mutex_unlock(&dentry->d_inode->i_mutex);
+	parent = dget_parent(dentry);
+	if (parent != dentry && parent->d_inode &&
+			needs_fixup(SDCARDFS_I(parent->d_inode)->perm)) {
+		get_derived_permission(parent, dentry);
+		fix_derived_permission(dentry->d_inode);
+	} else {
+		info->data_gen = gen;
 	}
+	dput(parent);
 }
 
 void fixup_top_recursive(struct dentry *parent) {
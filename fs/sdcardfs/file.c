@@ -19,34 +19,60 @@
  */
 
 #include "sdcardfs.h"
-#ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
 #include <linux/backing-dev.h>
-#endif
+#include <linux/aio.h>
+#include <linux/splice.h>
+#include <linux/fsnotify.h>
 
-static ssize_t sdcardfs_read(struct file *file, char __user *buf,
-			   size_t count, loff_t *ppos)
+/*
+ * Reads are served from the lower file, so its readahead state is the one
+ * that counts. Carry over what was set on our file with fadvise(): the
+ * random access hint, and the readahead window scaled from our bdi to the
+ * lower one.
+ */
+static void sdcardfs_sync_readahead(struct file *file, struct file *lower_file)
 {
-	int err;
-	struct file *lower_file;
-	struct dentry *dentry = file->f_path.dentry;
-#ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
-	struct backing_dev_info *bdi;
-#endif
-
-	lower_file = sdcardfs_lower_file(file);
+	struct backing_dev_info *bdi = file->f_mapping->backing_dev_info;
+	struct backing_dev_info *lower_bdi =
+		lower_file->f_mapping->backing_dev_info;
+	unsigned int ra_pages = lower_bdi->ra_pages;
 
 #ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
 	if (file->f_mode & FMODE_NOACTIVE) {
 		if (!(lower_file->f_mode & FMODE_NOACTIVE)) {
-			bdi = lower_file->f_mapping->backing_dev_info;
-			lower_file->f_ra.ra_pages = bdi->ra_pages * 2;
+			lower_file->f_ra.ra_pages = lower_bdi->ra_pages * 2;
 			spin_lock(&lower_file->f_lock);
 			lower_file->f_mode |= FMODE_NOACTIVE;
 			spin_unlock(&lower_file->f_lock);
 		}
+		return;
 	}
 #endif
 
+	if (bdi->ra_pages && file->f_ra.ra_pages != bdi->ra_pages)
+		ra_pages = lower_bdi->ra_pages * file->f_ra.ra_pages /
+			   bdi->ra_pages;
+	if (lower_file->f_ra.ra_pages != ra_pages)
+		lower_file->f_ra.ra_pages = ra_pages;
+
+	if ((file->f_mode ^ lower_file->f_mode) & FMODE_RANDOM) {
+		spin_lock(&lower_file->f_lock);
+		lower_file->f_mode = (lower_file->f_mode & ~FMODE_RANDOM) |
+				     (file->f_mode & FMODE_RANDOM);
+		spin_unlock(&lower_file->f_lock);
+	}
+}
+
+static ssize_t sdcardfs_read(struct file *file, char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	int err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	lower_file = sdcardfs_lower_file(file);
+	sdcardfs_sync_readahead(file, lower_file);
+
 	err = vfs_read(lower_file, buf, count, ppos);
 	/* update our inode atime upon a successful lower read */
 	if (err >= 0)
@@ -82,6 +108,177 @@ static ssize_t sdcardfs_write(struct file *file, const char __user *buf,
 	return err;
 }
 
+/*
+ * The aio methods hand the whole iovec to the lower file's aio methods in
+ * one go instead of going through vfs_readv()/vfs_writev() segment by
+ * segment. The lower request is issued on a sync kiocb of its own, since
+ * the caller's kiocb holds a reference to our file, not the lower one.
+ */
+static ssize_t sdcardfs_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				 unsigned long nr_segs, loff_t pos)
+{
+	ssize_t err;
+	struct file *file = iocb->ki_filp;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+	struct kiocb lower_iocb;
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op || !lower_file->f_op->aio_read)
+		return -EINVAL;
+
+	err = rw_verify_area(READ, lower_file, &pos,
+			     iov_length(iov, nr_segs));
+	if (err < 0)
+		return err;
+
+	sdcardfs_sync_readahead(file, lower_file);
+
+	init_sync_kiocb(&lower_iocb, lower_file);
+	lower_iocb.ki_pos = pos;
+	lower_iocb.ki_left = iocb->ki_left;
+	lower_iocb.ki_nbytes = iocb->ki_nbytes;
+
+	err = lower_file->f_op->aio_read(&lower_iocb, iov, nr_segs, pos);
+	if (err == -EIOCBQUEUED)
+		err = wait_on_sync_kiocb(&lower_iocb);
+	iocb->ki_pos = lower_iocb.ki_pos;
+
+	/* update our inode atime upon a successful lower read */
+	if (err >= 0) {
+		if (err > 0)
+			fsnotify_access(lower_file);
+		fsstack_copy_attr_atime(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	return err;
+}
+
+static ssize_t sdcardfs_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	ssize_t err;
+	struct file *file = iocb->ki_filp;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+	struct kiocb lower_iocb;
+
+	/* check disk space */
+	if (!check_min_free_space(dentry, iov_length(iov, nr_segs), 0)) {
+		printk(KERN_INFO "No minimum free space.\n");
+		return -ENOSPC;
+	}
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op || !lower_file->f_op->aio_write)
+		return -EINVAL;
+
+	err = rw_verify_area(WRITE, lower_file, &pos,
+			     iov_length(iov, nr_segs));
+	if (err < 0)
+		return err;
+
+	init_sync_kiocb(&lower_iocb, lower_file);
+	lower_iocb.ki_pos = pos;
+	lower_iocb.ki_left = iocb->ki_left;
+	lower_iocb.ki_nbytes = iocb->ki_nbytes;
+
+	err = lower_file->f_op->aio_write(&lower_iocb, iov, nr_segs, pos);
+	if (err == -EIOCBQUEUED)
+		err = wait_on_sync_kiocb(&lower_iocb);
+	iocb->ki_pos = lower_iocb.ki_pos;
+
+	/* update our inode times+sizes upon a successful lower write */
+	if (err >= 0) {
+		if (err > 0)
+			fsnotify_modify(lower_file);
+		fsstack_copy_inode_size(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+		fsstack_copy_attr_times(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	return err;
+}
+
+/*
+ * Splicing goes straight to the lower file, so that sendfile() and
+ * splice() from and to sdcardfs keep the lower file system's zero-copy
+ * page cache paths.
+ */
+static ssize_t sdcardfs_splice_read(struct file *file, loff_t *ppos,
+				    struct pipe_inode_info *pipe, size_t len,
+				    unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	lower_file = sdcardfs_lower_file(file);
+
+	err = rw_verify_area(READ, lower_file, ppos, len);
+	if (err < 0)
+		return err;
+
+	sdcardfs_sync_readahead(file, lower_file);
+
+	if (lower_file->f_op && lower_file->f_op->splice_read)
+		err = lower_file->f_op->splice_read(lower_file, ppos, pipe,
+						    len, flags);
+	else
+		err = default_file_splice_read(lower_file, ppos, pipe,
+					       len, flags);
+
+	/* update our inode atime upon a successful lower read */
+	if (err >= 0) {
+		if (err > 0)
+			fsnotify_access(lower_file);
+		fsstack_copy_attr_atime(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	return err;
+}
+
+static ssize_t sdcardfs_splice_write(struct pipe_inode_info *pipe,
+				     struct file *file, loff_t *ppos,
+				     size_t len, unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	/* check disk space */
+	if (!check_min_free_space(dentry, len, 0)) {
+		printk(KERN_INFO "No minimum free space.\n");
+		return -ENOSPC;
+	}
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op || !lower_file->f_op->splice_write)
+		return -EINVAL;
+
+	err = rw_verify_area(WRITE, lower_file, ppos, len);
+	if (err < 0)
+		return err;
+
+	err = lower_file->f_op->splice_write(pipe, lower_file, ppos, len,
+					     flags);
+
+	/* update our inode times+sizes upon a successful lower write */
+	if (err >= 0) {
+		if (err > 0)
+			fsnotify_modify(lower_file);
+		fsstack_copy_inode_size(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+		fsstack_copy_attr_times(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	return err;
+}
+
 static int sdcardfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 {
 	int err = 0;
@@ -333,6 +530,10 @@ const struct file_operations sdcardfs_main_fops = {
 	.llseek		= generic_file_llseek,
 	.read		= sdcardfs_read,
 	.write		= sdcardfs_write,
+	.aio_read	= sdcardfs_aio_read,
+	.aio_write	= sdcardfs_aio_write,
+	.splice_read	= sdcardfs_splice_read,
+	.splice_write	= sdcardfs_splice_write,
 	.unlocked_ioctl	= sdcardfs_unlocked_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= sdcardfs_compat_ioctl,
@@ -87,9 +87,12 @@ static int sdcardfs_create(struct inode *dir, struct dentry *dentry,
 	copied_fs = copy_fs_struct(current->fs);
 	current->fs = copied_fs;
 	current->fs->umask = 0;
+	sdcardfs_name_index_check(dir);
 	err = vfs_create(lower_parent_dentry->d_inode, lower_dentry, mode, nd);
 	if (err)
 		goto out;
+	sdcardfs_name_index_add(dir, lower_dentry->d_name.name,
+				lower_dentry->d_name.len);
 
 	err = sdcardfs_interpose(dentry, dir->i_sb, &lower_path, SDCARDFS_I(dir)->userid);
 	if (err)
@@ -185,6 +188,7 @@ static int sdcardfs_unlink(struct inode *dir, struct dentry *dentry)
 	err = mnt_want_write(lower_path.mnt);
 	if (err)
 		goto out_unlock;
+	sdcardfs_name_index_check(dir);
 	err = vfs_unlink(lower_dir_inode, lower_dentry);
 
 	/*
@@ -198,6 +202,8 @@ static int sdcardfs_unlink(struct inode *dir, struct dentry *dentry)
 		err = 0;
 	if (err)
 		goto out;
+	sdcardfs_name_index_del(dir, lower_dentry->d_name.name,
+				lower_dentry->d_name.len);
 	fsstack_copy_attr_times(dir, lower_dir_inode);
 	fsstack_copy_inode_size(dir, lower_dir_inode);
 	set_nlink(dentry->d_inode,
@@ -317,10 +323,13 @@ static int sdcardfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode
 	copied_fs = copy_fs_struct(current->fs);
 	current->fs = copied_fs;
 	current->fs->umask = 0;
+	sdcardfs_name_index_check(dir);
 	err = vfs_mkdir(lower_parent_dentry->d_inode, lower_dentry, mode);
 
 	if (err)
 		goto out;
+	sdcardfs_name_index_add(dir, lower_dentry->d_name.name,
+				lower_dentry->d_name.len);
 
 	/* if it is a local obb dentry, setup it with the base obbpath */
 	if(need_graft_path(dentry)) {
@@ -407,9 +416,12 @@ static int sdcardfs_rmdir(struct inode *dir, struct dentry *dentry)
 	err = mnt_want_write(lower_path.mnt);
 	if (err)
 		goto out_unlock;
+	sdcardfs_name_index_check(dir);
 	err = vfs_rmdir(lower_dir_dentry->d_inode, lower_dentry);
 	if (err)
 		goto out;
+	sdcardfs_name_index_del(dir, lower_dentry->d_name.name,
+				lower_dentry->d_name.len);
 
 	d_drop(dentry);	/* drop our dentry on success (why not VFS's job?) */
 	if (dentry->d_inode)
@@ -482,6 +494,7 @@ static int sdcardfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	struct dentry *new_parent = NULL;
 	struct path lower_old_path, lower_new_path;
 	const struct cred *saved_cred = NULL;
+	char *old_name = NULL, *new_name = NULL;
 
 	if(!check_caller_access_to_name(old_dir, old_dentry->d_name.name) ||
 		!check_caller_access_to_name(new_dir, new_dentry->d_name.name)) {
@@ -521,11 +534,29 @@ static int sdcardfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (err)
 		goto out_drop_old_write;
 
+	sdcardfs_name_index_check(old_dir);
+	if (new_dir != old_dir)
+		sdcardfs_name_index_check(new_dir);
+
+	/* vfs_rename() moves the lower names around, so save them first */
+	if (SDCARDFS_I(old_dir)->name_index || SDCARDFS_I(new_dir)->name_index) {
+		old_name = kstrdup(lower_old_dentry->d_name.name, GFP_KERNEL);
+		new_name = kstrdup(lower_new_dentry->d_name.name, GFP_KERNEL);
+	}
+
 	err = vfs_rename(lower_old_dir_dentry->d_inode, lower_old_dentry,
 			 lower_new_dir_dentry->d_inode, lower_new_dentry);
 	if (err)
 		goto out_err;
 
+	if (old_name && new_name) {
+		sdcardfs_name_index_del(old_dir, old_name, strlen(old_name));
+		sdcardfs_name_index_add(new_dir, new_name, strlen(new_name));
+	} else {
+		sdcardfs_name_index_free(old_dir);
+		sdcardfs_name_index_free(new_dir);
+	}
+
 	/* Copy attrs from lower dir, but i_uid/i_gid */
 	sdcardfs_copy_and_fix_attrs(new_dir, lower_new_dir_dentry->d_inode);
 	fsstack_copy_inode_size(new_dir, lower_new_dir_dentry->d_inode);
@@ -558,6 +589,8 @@ out_drop_old_write:
 	mnt_drop_write(lower_old_path.mnt);
 out:
 	unlock_rename(lower_old_dir_dentry, lower_new_dir_dentry);
+	kfree(old_name);
+	kfree(new_name);
 	dput(lower_old_dir_dentry);
 	dput(lower_new_dir_dentry);
 	sdcardfs_put_real_lower(old_dentry, &lower_old_path);
@@ -642,6 +675,23 @@ static int sdcardfs_permission(struct inode *inode, int mask)
 	int err;
 	struct inode *top = SDCARDFS_I(inode)->top;
 
+	/*
+	 * Bring the top inode up to date with the package list, for the
+	 * callers that reach us without a fresh lookup through it.
+	 */
+	if (SDCARDFS_I(top)->data_gen !=
+			atomic_read(&sdcardfs_pkgl_generation)) {
+		struct dentry *dentry;
+
+		if (mask & MAY_NOT_BLOCK)
+			return -ECHILD;
+		dentry = d_find_alias(top);
+		if (dentry) {
+			revalidate_derived_permission(dentry);
+			dput(dentry);
+		}
+	}
+
 	/* Ensure owner is up to date */
 	if (inode->i_uid != top->i_uid) {
 		SDCARDFS_I(inode)->d_uid = SDCARDFS_I(top)->d_uid;
@@ -20,6 +20,10 @@
 
 #include "sdcardfs.h"
 #include "linux/delay.h"
+#include <linux/ctype.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
 
 /* The dentry cache is just so we have properly sized dentries */
 static struct kmem_cache *sdcardfs_dentry_cachep;
@@ -211,6 +215,366 @@ out:
 	return err;
 }
 
+/*
+ * Case-insensitive name index
+ *
+ * When the exact-case lookup in the lower directory misses, the name is
+ * looked for again ignoring case. Instead of scanning the directory each
+ * time, a directory that takes such a miss gets an index of the casefolded
+ * names of all its lower entries. It is read once with vfs_readdir() and
+ * then kept up to date by our own create, mkdir, unlink, rmdir and rename.
+ * Changes made to the lower directory behind our back show up as a change
+ * of its mtime or ctime, and the index is then thrown away and rebuilt.
+ * Our own operations check for such changes before touching the lower
+ * directory, so that re-stamping the index afterwards cannot hide them.
+ *
+ * The index of a directory is protected by that directory's i_mutex, which
+ * the VFS holds across ->lookup and all the operations above.
+ */
+struct sdcardfs_name_entry {
+	struct hlist_node hlist;
+	unsigned int hash;		/* casefolded hash of name */
+	unsigned int len;
+	char name[0];
+};
+
+struct sdcardfs_name_index {
+	struct timespec mtime;		/* of the lower dir when in sync */
+	struct timespec ctime;
+	unsigned int count;		/* number of entries */
+	unsigned int bits;		/* log2 of the number of buckets */
+	struct hlist_head buckets[0];
+};
+
+#define SDCARDFS_NAME_INDEX_MIN_BITS	4
+
+/* must match sdcardfs_hash_ci() */
+static unsigned int sdcardfs_name_hash(const char *name, unsigned int len)
+{
+	unsigned long hash = init_name_hash();
+
+	while (len--)
+		hash = partial_name_hash(tolower(*name++), hash);
+	return end_name_hash(hash);
+}
+
+static inline struct hlist_head *name_index_bucket(
+		struct sdcardfs_name_index *index, unsigned int hash)
+{
+	return &index->buckets[hash_32(hash, index->bits)];
+}
+
+static struct sdcardfs_name_entry *name_entry_alloc(const char *name,
+						    unsigned int len)
+{
+	struct sdcardfs_name_entry *entry;
+
+	entry = kmalloc(sizeof(*entry) + len + 1, GFP_KERNEL);
+	if (!entry)
+		return NULL;
+
+	entry->hash = sdcardfs_name_hash(name, len);
+	entry->len = len;
+	memcpy(entry->name, name, len);
+	entry->name[len] = '\0';
+	return entry;
+}
+
+static struct sdcardfs_name_entry *name_index_find(
+		struct sdcardfs_name_index *index, const char *name,
+		unsigned int len, bool exact)
+{
+	unsigned int hash = sdcardfs_name_hash(name, len);
+	struct sdcardfs_name_entry *entry;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(entry, pos, name_index_bucket(index, hash), hlist) {
+		if (entry->hash != hash || entry->len != len)
+			continue;
+		if (exact ? !memcmp(entry->name, name, len) :
+			    !strncasecmp(entry->name, name, len))
+			return entry;
+	}
+	return NULL;
+}
+
+static inline void name_index_sync(struct sdcardfs_name_index *index,
+				   struct inode *lower_dir)
+{
+	index->mtime = lower_dir->i_mtime;
+	index->ctime = lower_dir->i_ctime;
+}
+
+static inline bool name_index_in_sync(struct sdcardfs_name_index *index,
+				      struct inode *lower_dir)
+{
+	return timespec_equal(&index->mtime, &lower_dir->i_mtime) &&
+		timespec_equal(&index->ctime, &lower_dir->i_ctime);
+}
+
+static void name_index_destroy(struct sdcardfs_name_index *index)
+{
+	struct sdcardfs_name_entry *entry;
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < (1U << index->bits); i++)
+		hlist_for_each_entry_safe(entry, pos, n, &index->buckets[i],
+					  hlist)
+			kfree(entry);
+
+	if (is_vmalloc_addr(index))
+		vfree(index);
+	else
+		kfree(index);
+}
+
+void sdcardfs_name_index_free(struct inode *dir)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dir);
+
+	if (info->name_index) {
+		name_index_destroy(info->name_index);
+		info->name_index = NULL;
+	}
+}
+
+struct name_index_fill {
+	struct hlist_head entries;
+	unsigned int count;
+	int err;
+};
+
+static int name_index_filldir(void *buf, const char *name, int len,
+			      loff_t pos, u64 ino, unsigned int d_type)
+{
+	struct name_index_fill *fill = buf;
+	struct sdcardfs_name_entry *entry;
+
+	if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+		return 0;
+
+	entry = name_entry_alloc(name, len);
+	if (!entry) {
+		fill->err = -ENOMEM;
+		return -ENOMEM;
+	}
+	hlist_add_head(&entry->hlist, &fill->entries);
+	fill->count++;
+	return 0;
+}
+
+/*
+ * name_index_build - read the lower directory at 'lower_dir_path' into a
+ * new index. Returns NULL on failure.
+ */
+static struct sdcardfs_name_index *name_index_build(
+		struct path *lower_dir_path)
+{
+	struct inode *lower_dir = lower_dir_path->dentry->d_inode;
+	struct sdcardfs_name_index *index = NULL;
+	struct sdcardfs_name_entry *entry;
+	struct name_index_fill fill;
+	struct hlist_node *pos, *n;
+	struct timespec mtime, ctime;
+	struct file *file;
+	unsigned int bits;
+	size_t size;
+	int err;
+
+	INIT_HLIST_HEAD(&fill.entries);
+	fill.count = 0;
+	fill.err = 0;
+
+	/* before reading, so that racing changes leave the index stale */
+	mtime = lower_dir->i_mtime;
+	ctime = lower_dir->i_ctime;
+
+	file = dentry_open(dget(lower_dir_path->dentry),
+			   mntget(lower_dir_path->mnt),
+			   O_RDONLY | O_DIRECTORY, current_cred());
+	if (IS_ERR(file))
+		return NULL;
+
+	for (;;) {
+		unsigned int count = fill.count;
+
+		err = vfs_readdir(file, name_index_filldir, &fill);
+		if (err || fill.err || fill.count == count)
+			break;
+	}
+	fput(file);
+	if (err || fill.err)
+		goto out_free;
+
+	bits = max_t(unsigned int, order_base_2(fill.count),
+		     SDCARDFS_NAME_INDEX_MIN_BITS);
+	size = sizeof(*index) + (sizeof(struct hlist_head) << bits);
+	if (size > PAGE_SIZE)
+		index = vzalloc(size);
+	else
+		index = kzalloc(size, GFP_KERNEL);
+	if (!index)
+		goto out_free;
+
+	index->mtime = mtime;
+	index->ctime = ctime;
+	index->count = fill.count;
+	index->bits = bits;
+	hlist_for_each_entry_safe(entry, pos, n, &fill.entries, hlist) {
+		hlist_del(&entry->hlist);
+		hlist_add_head(&entry->hlist,
+			       name_index_bucket(index, entry->hash));
+	}
+	return index;
+
+out_free:
+	hlist_for_each_entry_safe(entry, pos, n, &fill.entries, hlist)
+		kfree(entry);
+	return NULL;
+}
+
+/*
+ * sdcardfs_name_index_check - drop the index of 'dir' if its lower directory
+ * was changed behind our back. Called before we change the lower directory
+ * ourselves, with it locked, so that sdcardfs_name_index_add() and _del()
+ * only re-stamp an index which was in sync up to our own change and do not
+ * absorb changes made through another view or on the lower fs directly.
+ * Caller holds dir->i_mutex.
+ */
+void sdcardfs_name_index_check(struct inode *dir)
+{
+	struct sdcardfs_name_index *index = SDCARDFS_I(dir)->name_index;
+
+	if (index && !name_index_in_sync(index, sdcardfs_lower_inode(dir)))
+		sdcardfs_name_index_free(dir);
+}
+
+/*
+ * sdcardfs_name_index_add - record that 'name' was created in the lower
+ * directory of 'dir'. Caller holds dir->i_mutex and called
+ * sdcardfs_name_index_check() before creating it.
+ */
+void sdcardfs_name_index_add(struct inode *dir, const char *name,
+			     unsigned int len)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dir);
+	struct sdcardfs_name_index *index = info->name_index;
+	struct sdcardfs_name_entry *entry;
+
+	if (!index)
+		return;
+
+	if (!name_index_find(index, name, len, true)) {
+		/* rebuilt with more buckets on the next miss */
+		if (index->count >= (2U << index->bits))
+			goto drop;
+		entry = name_entry_alloc(name, len);
+		if (!entry)
+			goto drop;
+		hlist_add_head(&entry->hlist,
+			       name_index_bucket(index, entry->hash));
+		index->count++;
+	}
+	name_index_sync(index, sdcardfs_lower_inode(dir));
+	return;
+
+drop:
+	sdcardfs_name_index_free(dir);
+}
+
+/*
+ * sdcardfs_name_index_del - record that 'name' was removed from the lower
+ * directory of 'dir'. Caller holds dir->i_mutex and called
+ * sdcardfs_name_index_check() before removing it.
+ */
+void sdcardfs_name_index_del(struct inode *dir, const char *name,
+			     unsigned int len)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dir);
+	struct sdcardfs_name_index *index = info->name_index;
+	struct sdcardfs_name_entry *entry;
+
+	if (!index)
+		return;
+
+	entry = name_index_find(index, name, len, true);
+	if (!entry) {
+		/* we never saw it, so the index was out of date */
+		sdcardfs_name_index_free(dir);
+		return;
+	}
+	hlist_del(&entry->hlist);
+	kfree(entry);
+	index->count--;
+	name_index_sync(index, sdcardfs_lower_inode(dir));
+}
+
+/*
+ * Fallback for when no index can be built: only finds names which are
+ * already in the dcache.
+ */
+static int sdcardfs_ci_lookup_dcache(struct path *lower_dir_path,
+				     const char *name, struct path *path)
+{
+	struct dentry *lower_dir_dentry = lower_dir_path->dentry;
+	struct dentry *child;
+	struct dentry *match = NULL;
+	int err = -ENOENT;
+
+	spin_lock(&lower_dir_dentry->d_lock);
+	list_for_each_entry(child, &lower_dir_dentry->d_subdirs, d_child) {
+		if (child && child->d_inode) {
+			if (strcasecmp(child->d_name.name, name)==0) {
+				match = dget(child);
+				break;
+			}
+		}
+	}
+	spin_unlock(&lower_dir_dentry->d_lock);
+	if (match) {
+		err = vfs_path_lookup(lower_dir_dentry, lower_dir_path->mnt,
+					match->d_name.name, 0, path);
+		dput(match);
+	}
+	return err;
+}
+
+/*
+ * sdcardfs_ci_lookup - look 'name' up ignoring case in the lower directory
+ * 'lower_dir_path' of 'dir', going through the name index of 'dir'.
+ *
+ * Caller holds dir->i_mutex.
+ */
+static int sdcardfs_ci_lookup(struct inode *dir, struct path *lower_dir_path,
+			      const char *name, struct path *path)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dir);
+	struct inode *lower_dir = lower_dir_path->dentry->d_inode;
+	struct sdcardfs_name_entry *entry;
+	int err;
+
+	if (info->name_index && !name_index_in_sync(info->name_index, lower_dir))
+		sdcardfs_name_index_free(dir);
+
+	if (!info->name_index) {
+		info->name_index = name_index_build(lower_dir_path);
+		if (!info->name_index)
+			return sdcardfs_ci_lookup_dcache(lower_dir_path, name,
+							 path);
+	}
+
+	entry = name_index_find(info->name_index, name, strlen(name), false);
+	if (!entry)
+		return -ENOENT;
+
+	err = vfs_path_lookup(lower_dir_path->dentry, lower_dir_path->mnt,
+			      entry->name, 0, path);
+	if (err == -ENOENT)
+		sdcardfs_name_index_free(dir);
+	return err;
+}
+
 /*
  * Main driver function for sdcardfs's lookup.
  *
@@ -245,27 +609,10 @@ static struct dentry *__sdcardfs_lookup(struct dentry *dentry,
 	err = vfs_path_lookup(lower_dir_dentry, lower_dir_mnt, name, 0,
 				&lower_nd.path);
 	/* check for other cases */
-	if (err == -ENOENT) {
-		struct dentry *child;
-		struct dentry *match = NULL;
-		spin_lock(&lower_dir_dentry->d_lock);
-		list_for_each_entry(child, &lower_dir_dentry->d_subdirs, d_child) {
-			if (child && child->d_inode) {
-				if (strcasecmp(child->d_name.name, name)==0) {
-					match = dget(child);
-					break;
-				}
-			}
-		}
-		spin_unlock(&lower_dir_dentry->d_lock);
-		if (match) {
-			err = vfs_path_lookup(lower_dir_dentry,
-						lower_dir_mnt,
-						match->d_name.name, 0,
-						&lower_nd.path);
-			dput(match);
-		}
-	}
+	if (err == -ENOENT)
+		err = sdcardfs_ci_lookup(dentry->d_parent->d_inode,
+					 lower_parent_path, name,
+					 &lower_nd.path);
 
 	/* no error: handle positive dentries */
 	if (!err) {
@@ -21,6 +21,7 @@
 #include "sdcardfs.h"
 #include "linux/hashtable.h"
 #include <linux/delay.h>
+#include <linux/ctype.h>
 
 
 #include <linux/init.h>
@@ -31,10 +32,18 @@
 
 #define STRING_BUF_SIZE		(512)
 
+/*
+ * Lookups walk the table under RCU only. Writers serialize on
+ * hashtable_lock and never modify a published entry: a new value is
+ * installed by replacing the whole entry, and old entries are freed
+ * after a grace period.
+ */
 struct hashtable_entry {
         struct hlist_node hlist;
         void *key;
+	unsigned int hash;	/* case-folded hash of key */
 	unsigned int value;
+	struct rcu_head rcu;
 };
 
 struct sb_list {
@@ -49,18 +58,18 @@ struct packagelist_data {
 
 static struct packagelist_data *pkgl_data_all;
 
+/* bumped on every package list change, see revalidate_derived_permission() */
+atomic_t sdcardfs_pkgl_generation = ATOMIC_INIT(0);
+
 static struct kmem_cache *hashtable_entry_cachep;
 
+/* keys are compared with strcasecmp(), so the hash must ignore case too */
 static unsigned int str_hash(const char *key) {
-	int i;
-	unsigned int h = strlen(key);
-	char *data = (char *)key;
+	unsigned long h = init_name_hash();
 
-	for (i = 0; i < strlen(key); i++) {
-		h = h * 31 + *data;
-		data++;
-	}
-	return h;
+	while (*key)
+		h = partial_name_hash(tolower(*key++), h);
+	return end_name_hash(h);
 }
 
 appid_t get_appid(void *pkgl_id, const char *app_name)
@@ -69,18 +78,17 @@ appid_t get_appid(void *pkgl_id, const char *app_name)
 	struct hashtable_entry *hash_cur;
 	struct hlist_node *h_n;
 	unsigned int hash = str_hash(app_name);
-	appid_t ret_id;
+	appid_t ret_id = 0;
 
-	spin_lock(&pkgl_dat->hashtable_lock);
-	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, h_n, hlist, hash) {
-		if (!strcasecmp(app_name, hash_cur->key)) {
+	rcu_read_lock();
+	hash_for_each_possible_rcu(pkgl_dat->package_to_appid, hash_cur, h_n, hlist, hash) {
+		if (hash_cur->hash == hash && !strcasecmp(app_name, hash_cur->key)) {
 			ret_id = (appid_t)hash_cur->value;
-			spin_unlock(&pkgl_dat->hashtable_lock);
-			return ret_id;
+			break;
 		}
 	}
-	spin_unlock(&pkgl_dat->hashtable_lock);
-	return 0;
+	rcu_read_unlock();
+	return ret_id;
 }
 
 /* Kernel has already enforced everything we returned through
@@ -120,80 +128,93 @@ int open_flags_to_access_mode(int open_flags) {
 	}
 }
 
-static int insert_str_to_int_lock(struct packagelist_data *pkgl_dat, char *key,
-		unsigned int value)
+static struct hashtable_entry *alloc_hashtable_entry(const char *key,
+		unsigned int hash, unsigned int value)
 {
-	struct hashtable_entry *hash_cur;
 	struct hashtable_entry *new_entry;
-	struct hlist_node *h_n;
-	unsigned int hash = str_hash(key);
 
-	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, h_n, hlist, hash) {
-		if (!strcasecmp(key, hash_cur->key)) {
-			hash_cur->value = value;
-			return 0;
-		}
-	}
-	new_entry = kmem_cache_alloc(hashtable_entry_cachep, GFP_ATOMIC);
+	new_entry = kmem_cache_alloc(hashtable_entry_cachep, GFP_KERNEL);
 	if (!new_entry)
-		return -ENOMEM;
-	new_entry->key = kstrdup(key, GFP_ATOMIC);
+		return NULL;
+	new_entry->key = kstrdup(key, GFP_KERNEL);
+	if (!new_entry->key) {
+		kmem_cache_free(hashtable_entry_cachep, new_entry);
+		return NULL;
+	}
+	new_entry->hash = hash;
 	new_entry->value = value;
-	hash_add(pkgl_dat->package_to_appid, &new_entry->hlist, hash);
-	return 0;
+	return new_entry;
 }
 
-static void fixup_perms(struct super_block *sb, const char *key) {
-	if (sb && sb->s_magic == SDCARDFS_SUPER_MAGIC) {
-		fixup_perms_recursive(sb->s_root, key, strlen(key));
-	}
+static void free_hashtable_entry(struct hashtable_entry *h_entry)
+{
+	kfree(h_entry->key);
+	kmem_cache_free(hashtable_entry_cachep, h_entry);
+}
+
+static void free_hashtable_entry_rcu(struct rcu_head *head)
+{
+	free_hashtable_entry(container_of(head, struct hashtable_entry, rcu));
+}
+
+/* Derived permissions of all mounts are revalidated lazily against the
+ * new package list; see revalidate_derived_permission(). */
+static void fixup_perms(void) {
+	smp_mb__before_atomic_inc();
+	atomic_inc(&sdcardfs_pkgl_generation);
 }
 
 static int insert_str_to_int(struct packagelist_data *pkgl_dat, char *key,
 		unsigned int value) {
-	int ret;
-	struct sdcardfs_sb_info *sbinfo;
-	mutex_lock(&sdcardfs_super_list_lock);
-	spin_lock(&pkgl_dat->hashtable_lock);
-	ret = insert_str_to_int_lock(pkgl_dat, key, value);
-	spin_unlock(&pkgl_dat->hashtable_lock);
+	struct hashtable_entry *hash_cur;
+	struct hashtable_entry *new_entry;
+	struct hlist_node *h_n;
+	unsigned int hash = str_hash(key);
 
-	list_for_each_entry(sbinfo, &sdcardfs_super_list, list) {
-		if (sbinfo) {
-			fixup_perms(sbinfo->sb, key);
+	new_entry = alloc_hashtable_entry(key, hash, value);
+	if (!new_entry)
+		return -ENOMEM;
+
+	spin_lock(&pkgl_dat->hashtable_lock);
+	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, h_n, hlist, hash) {
+		if (hash_cur->hash == hash && !strcasecmp(key, hash_cur->key)) {
+			if (hash_cur->value == value) {
+				spin_unlock(&pkgl_dat->hashtable_lock);
+				free_hashtable_entry(new_entry);
+				return 0;
+			}
+			hlist_replace_rcu(&hash_cur->hlist, &new_entry->hlist);
+			call_rcu(&hash_cur->rcu, free_hashtable_entry_rcu);
+			goto out;
 		}
 	}
-	mutex_unlock(&sdcardfs_super_list_lock);
-	return ret;
+	hash_add_rcu(pkgl_dat->package_to_appid, &new_entry->hlist, hash);
+out:
+	spin_unlock(&pkgl_dat->hashtable_lock);
+
+	fixup_perms();
+	return 0;
 }
 
 static void remove_str_to_int_lock(struct hashtable_entry *h_entry) {
-	kfree(h_entry->key);
-	hash_del(&h_entry->hlist);
-	kmem_cache_free(hashtable_entry_cachep, h_entry);
+	hash_del_rcu(&h_entry->hlist);
+	call_rcu(&h_entry->rcu, free_hashtable_entry_rcu);
 }
 
 static void remove_str_to_int(struct packagelist_data *pkgl_dat, const char *key)
 {
-	struct sdcardfs_sb_info *sbinfo;
 	struct hashtable_entry *hash_cur;
 	struct hlist_node *h_n;
 	unsigned int hash = str_hash(key);
-	mutex_lock(&sdcardfs_super_list_lock);
-	spin_lock(&pkgl_data_all->hashtable_lock);
+	spin_lock(&pkgl_dat->hashtable_lock);
 	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, h_n, hlist, hash) {
-		if (!strcasecmp(key, hash_cur->key)) {
+		if (hash_cur->hash == hash && !strcasecmp(key, hash_cur->key)) {
 			remove_str_to_int_lock(hash_cur);
 			break;
 		}
 	}
-	spin_unlock(&pkgl_data_all->hashtable_lock);
-	list_for_each_entry(sbinfo, &sdcardfs_super_list, list) {
-		if (sbinfo) {
-			fixup_perms(sbinfo->sb, key);
-		}
-	}
-	mutex_unlock(&sdcardfs_super_list_lock);
+	spin_unlock(&pkgl_dat->hashtable_lock);
+	fixup_perms();
 	return;
 }
 
@@ -204,12 +225,10 @@ static void remove_all_hashentrys(struct packagelist_data *pkgl_dat)
 	struct hlist_node *h_t;
 	int i;
 
-	spin_lock(&pkgl_data_all->hashtable_lock);
+	spin_lock(&pkgl_dat->hashtable_lock);
 	hash_for_each_safe(pkgl_dat->package_to_appid, i, h_t, h_n, hash_cur, hlist)
                 remove_str_to_int_lock(hash_cur);
-	spin_unlock(&pkgl_data_all->hashtable_lock);
-
-	hash_init(pkgl_dat->package_to_appid);
+	spin_unlock(&pkgl_dat->hashtable_lock);
 }
 
 static struct packagelist_data * packagelist_create(void)
@@ -230,9 +249,9 @@ static struct packagelist_data * packagelist_create(void)
 
 static void packagelist_destroy(struct packagelist_data *pkgl_dat)
 {
-	spin_lock(&pkgl_dat->hashtable_lock);
 	remove_all_hashentrys(pkgl_dat);
-	spin_unlock(&pkgl_dat->hashtable_lock);
+	/* wait for the entries to be freed before the cache goes away */
+	rcu_barrier();
 	printk(KERN_INFO "sdcardfs: destroyed packagelist pkgld\n");
 	kfree(pkgl_dat);
 }
@@ -351,14 +370,13 @@ static ssize_t packages_attr_show(struct config_item *item,
 					 char *page)
 {
 	struct hashtable_entry *hash_cur;
-	struct hlist_node *h_t;
 	struct hlist_node *h_n;
 	int i;
 	int count = 0, written = 0;
 	char errormsg[] = "<truncated>\n";
 
-	spin_lock(&pkgl_data_all->hashtable_lock);
-	hash_for_each_safe(pkgl_data_all->package_to_appid, i, h_t, h_n, hash_cur, hlist) {
+	rcu_read_lock();
+	hash_for_each_rcu(pkgl_data_all->package_to_appid, i, h_n, hash_cur, hlist) {
 		written = scnprintf(page + count, PAGE_SIZE - sizeof(errormsg) - count, "%s %d\n", (char *)hash_cur->key, hash_cur->value);
 		if (count + written == PAGE_SIZE - sizeof(errormsg)) {
 			count += scnprintf(page + count, PAGE_SIZE - count, errormsg);
@@ -366,7 +384,7 @@ static ssize_t packages_attr_show(struct config_item *item,
 		}
 		count += written;
 	}
-	spin_unlock(&pkgl_data_all->hashtable_lock);
+	rcu_read_unlock();
 
 
 	return count;
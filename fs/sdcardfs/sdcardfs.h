@@ -153,6 +153,12 @@ extern struct inode *sdcardfs_iget(struct super_block *sb,
 				 struct inode *lower_inode, userid_t id);
 extern int sdcardfs_interpose(struct dentry *dentry, struct super_block *sb,
 			    struct path *lower_path, userid_t id);
+extern void sdcardfs_name_index_check(struct inode *dir);
+extern void sdcardfs_name_index_add(struct inode *dir, const char *name,
+				    unsigned int len);
+extern void sdcardfs_name_index_del(struct inode *dir, const char *name,
+				    unsigned int len);
+extern void sdcardfs_name_index_free(struct inode *dir);
 
 /* file private data */
 struct sdcardfs_file_info {
@@ -160,6 +166,8 @@ struct sdcardfs_file_info {
 	const struct vm_operations_struct *lower_vm_ops;
 };
 
+struct sdcardfs_name_index;
+
 /* sdcardfs inode data in memory */
 struct sdcardfs_inode_info {
 	struct inode *lower_inode;
@@ -170,6 +178,10 @@ struct sdcardfs_inode_info {
 	bool under_android;
 	/* top folder for ownership */
 	struct inode *top;
+	/* sdcardfs_pkgl_generation the derived state was computed at */
+	int data_gen;
+	/* casefolded names of a directory's entries, protected by i_mutex */
+	struct sdcardfs_name_index *name_index;
 
 	struct inode vfs_inode;
 };
@@ -398,6 +410,7 @@ extern struct list_head sdcardfs_super_list;
 
 /* for packagelist.c */
 extern appid_t get_appid(void *pkgl_id, const char *app_name);
+extern atomic_t sdcardfs_pkgl_generation;
 extern int check_caller_access_to_name(struct inode *parent_node, const char* name);
 extern int open_flags_to_access_mode(int open_flags);
 extern int packagelist_init(void);
@@ -409,7 +422,7 @@ extern void setup_derived_state(struct inode *inode, perm_t perm, userid_t useri
 extern void get_derived_permission(struct dentry *parent, struct dentry *dentry);
 extern void get_derived_permission_new(struct dentry *parent, struct dentry *dentry, struct dentry *newdentry);
 extern void fixup_top_recursive(struct dentry *parent);
-extern void fixup_perms_recursive(struct dentry *dentry, const char *name, size_t len);
+extern void revalidate_derived_permission(struct dentry *dentry);
 
 extern void update_derived_permission_lock(struct dentry *dentry);
 extern int need_graft_path(struct dentry *dentry);
@@ -124,6 +124,7 @@ static void sdcardfs_evict_inode(struct inode *inode)
 	 * Decrement a reference to a lower_inode, which was incremented
 	 * by our read_inode when it was created initially.
 	 */
+	sdcardfs_name_index_free(inode);
 	lower_inode = sdcardfs_lower_inode(inode);
 	sdcardfs_set_lower_inode(inode, NULL);
 	iput(lower_inode);
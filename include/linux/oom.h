@@ -43,6 +43,49 @@ enum oom_constraint {
 extern void compare_swap_oom_score_adj(int old_val, int new_val);
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+/* cursor of a walk over the thread group leaders by oom_score_adj */
+struct oom_adj_iter {
+	int adj;		/* oom_score_adj of the bucket being walked */
+	int min_adj;		/* lowest oom_score_adj to walk down to */
+	int restarts;		/* of the current bucket */
+	int budget;		/* entries left before the bucket is restarted */
+	struct hlist_nulls_node *pos;
+};
+
+extern void oom_adj_bucket_init(void);
+extern void oom_adj_bucket_add(struct task_struct *p);
+extern void oom_adj_bucket_del(struct task_struct *p);
+extern void oom_adj_bucket_replace(struct task_struct *old,
+				   struct task_struct *new);
+extern void oom_adj_bucket_update(struct task_struct *p);
+extern struct task_struct *oom_adj_iter_first(struct oom_adj_iter *iter,
+					      int min_adj);
+extern struct task_struct *oom_adj_iter_next(struct oom_adj_iter *iter,
+					     bool stop);
+#else
+static inline void oom_adj_bucket_init(void)
+{
+}
+
+static inline void oom_adj_bucket_add(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_bucket_del(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_bucket_replace(struct task_struct *old,
+					  struct task_struct *new)
+{
+}
+
+static inline void oom_adj_bucket_update(struct task_struct *p)
+{
+}
+#endif
+
 extern unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *memcg,
 			const nodemask_t *nodemask, unsigned long totalpages);
 extern int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_flags);
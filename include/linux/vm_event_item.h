@@ -62,6 +62,10 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		THP_COLLAPSE_ALLOC,
 		THP_COLLAPSE_ALLOC_FAILED,
 		THP_SPLIT,
+#endif
+#ifdef CONFIG_SWAP
+		SWAP_RA,	/* pages read ahead from swap */
+		SWAP_RA_HIT,	/* of which were then faulted in */
 #endif
 		NR_VM_EVENT_ITEMS
 };
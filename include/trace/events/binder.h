@@ -0,0 +1,82 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_TRACE_EVENT_BINDER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_EVENT_BINDER_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+TRACE_EVENT(binder_transaction_received,
+
+	TP_PROTO(int debug_id,
+		 int to_proc,
+		 int to_thread,
+		 int reply,
+		 u64 queue_us),
+
+	TP_ARGS(debug_id, to_proc, to_thread, reply, queue_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(u64, queue_us)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id	= debug_id;
+		__entry->to_proc	= to_proc;
+		__entry->to_thread	= to_thread;
+		__entry->reply		= reply;
+		__entry->queue_us	= queue_us;
+	),
+
+	TP_printk("transaction=%d dest=%d:%d reply=%d queue_us=%llu",
+		__entry->debug_id, __entry->to_proc, __entry->to_thread,
+		__entry->reply, (unsigned long long)__entry->queue_us)
+);
+
+TRACE_EVENT(binder_transaction_replied,
+
+	TP_PROTO(int debug_id,
+		 int proc,
+		 int thread,
+		 u64 latency_us),
+
+	TP_ARGS(debug_id, proc, thread, latency_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, proc)
+		__field(int, thread)
+		__field(u64, latency_us)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id	= debug_id;
+		__entry->proc		= proc;
+		__entry->thread		= thread;
+		__entry->latency_us	= latency_us;
+	),
+
+	TP_printk("transaction=%d replier=%d:%d latency_us=%llu",
+		__entry->debug_id, __entry->proc, __entry->thread,
+		(unsigned long long)__entry->latency_us)
+);
+
+#endif
+
+#include <trace/define_trace.h>
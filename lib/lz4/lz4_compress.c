@@ -0,0 +1,143 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ *
+ * Compressor for the LZ4 block format.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+static inline unsigned char *lz4_put_literals(unsigned char *op,
+		const unsigned char *anchor, size_t len, unsigned char **token)
+{
+	*token = op++;
+	if (len >= RUN_MASK) {
+		**token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		**token = (unsigned char)(len << ML_BITS);
+	}
+	memcpy(op, anchor, len);
+	return op + len;
+}
+
+/* extend a match of at least MINMATCH bytes; returns the end of the match */
+static inline const unsigned char *lz4_count(const unsigned char *ip,
+		const unsigned char *ref, const unsigned char *matchlimit)
+{
+	while (ip < matchlimit - (sizeof(unsigned long) - 1)) {
+		unsigned long diff = LZ4_READLONG(ref) ^ LZ4_READLONG(ip);
+
+		if (!diff) {
+			ip += sizeof(unsigned long);
+			ref += sizeof(unsigned long);
+			continue;
+		}
+		return ip + lz4_nbcommonbytes(diff);
+	}
+	while (ip < matchlimit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+	return ip;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *const iend = src + src_len;
+	const unsigned char *const mflimit = iend - MFLIMIT;
+	const unsigned char *const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+
+	if (src_len > LZ4_MAX_INPUT_SIZE)
+		return -1;
+
+	if (src_len < LZ4_MIN_LENGTH)
+		goto last_literals;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	for (;;) {
+		const unsigned char *ref;
+		unsigned int attempts = 1 << SKIPSTRENGTH;
+		size_t len;
+
+		/* find a match */
+		for (;;) {
+			u32 h;
+
+			if (unlikely(ip > mflimit))
+				goto last_literals;
+
+			h = LZ4_HASH_VALUE(ip);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+			if (ref < ip && ip - ref <= MAX_DISTANCE &&
+					LZ4_READ32(ref) == LZ4_READ32(ip))
+				break;
+			ip += attempts++ >> SKIPSTRENGTH;
+		}
+
+		/* catch up */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		op = lz4_put_literals(op, anchor, ip - anchor, &token);
+
+		/* offset */
+		put_unaligned_le16((u16)(ip - ref), op);
+		op += 2;
+
+		/* match length */
+		anchor = ip;
+		ip = lz4_count(ip + MINMATCH, ref + MINMATCH, matchlimit);
+		len = ip - anchor - MINMATCH;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += (unsigned char)len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+
+		/* fill the table with the position just before the match end */
+		hash_table[LZ4_HASH_VALUE(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	op = lz4_put_literals(op, anchor, iend - anchor, &token);
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
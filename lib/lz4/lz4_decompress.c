@@ -0,0 +1,112 @@
+/*
+ * LZ4 Decompressor for Linux kernel
+ *
+ * Safe decoder for the LZ4 block format: every length read from the
+ * stream is checked against both the input and output buffers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/* copy a match that may overlap its own output */
+static inline void lz4_copy_match(unsigned char *op, const unsigned char *ref,
+		size_t len)
+{
+	if (op - ref >= LZ4_COPYSTEP) {
+		while (len >= LZ4_COPYSTEP) {
+			LZ4_COPY8(op, ref);
+			op += LZ4_COPYSTEP;
+			ref += LZ4_COPYSTEP;
+			len -= LZ4_COPYSTEP;
+		}
+	}
+	while (len--)
+		*op++ = *ref++;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *const oend = dst + *dst_len;
+
+	for (;;) {
+		unsigned int token;
+		size_t length, offset;
+		unsigned int s;
+
+		if (unlikely(ip >= iend))
+			goto _output_error;
+
+		/* literal length */
+		token = *ip++;
+		length = token >> ML_BITS;
+		if (length == RUN_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto _output_error;
+				s = *ip++;
+				length += s;
+			} while (s == 255);
+		}
+
+		/* copy literals */
+		if (unlikely(length > (size_t)(iend - ip) ||
+				length > (size_t)(oend - op)))
+			goto _output_error;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* the last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		/* offset */
+		if (unlikely(iend - ip < 2))
+			goto _output_error;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto _output_error;
+
+		/* match length */
+		length = token & ML_MASK;
+		if (length == ML_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto _output_error;
+				s = *ip++;
+				length += s;
+			} while (s == 255);
+		}
+		length += MINMATCH;
+
+		if (unlikely(length > (size_t)(oend - op)))
+			goto _output_error;
+		lz4_copy_match(op, op - offset, length);
+		op += length;
+	}
+
+	*dst_len = op - dst;
+	return 0;
+
+	/* write overflow error detected */
+_output_error:
+	return -1;
+}
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,56 @@
+/*
+ * lz4defs.h -- architecture specific defines for the LZ4 block format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Architecture-specific macros
+ */
+#define LZ4_COPYSTEP	8
+
+#define LZ4_READ32(p)		get_unaligned((const u32 *)(p))
+#define LZ4_READLONG(p)		get_unaligned((const unsigned long *)(p))
+#define LZ4_COPY8(d, s)		\
+	put_unaligned(get_unaligned((const u64 *)(s)), (u64 *)(d))
+
+/*
+ * Format constants
+ */
+#define MINMATCH	4
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/* last 5 bytes of a block are always literals */
+#define LASTLITERALS	5
+/* a match must start at least 12 bytes before the end of the block */
+#define MFLIMIT		(LZ4_COPYSTEP + MINMATCH)
+#define LZ4_MIN_LENGTH	(MFLIMIT + 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* input larger than this could overflow the length encoding */
+#define LZ4_MAX_INPUT_SIZE	0x7E000000
+
+/*
+ * Increasing the skip strength makes the compressor give up sooner on
+ * incompressible data, at the cost of ratio.
+ */
+#define SKIPSTRENGTH	6
+
+#define LZ4_HASH_VALUE(p)	\
+	((LZ4_READ32(p) * 2654435761U) >> ((MINMATCH * 8) - LZ4_HASH_LOG))
+
+/* number of identical leading bytes given a non zero xor of two words */
+static inline unsigned int lz4_nbcommonbytes(unsigned long diff)
+{
+#if defined(__LITTLE_ENDIAN)
+	return __ffs(diff) >> 3;
+#else
+	return (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+}
@@ -35,6 +35,8 @@
 #include <linux/freezer.h>
 #include <linux/ftrace.h>
 #include <linux/ratelimit.h>
+#include <linux/rculist.h>
+#include <linux/rculist_nulls.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/oom.h>
@@ -58,8 +60,10 @@ void compare_swap_oom_score_adj(int old_val, int new_val)
 	struct sighand_struct *sighand = current->sighand;
 
 	spin_lock_irq(&sighand->siglock);
-	if (current->signal->oom_score_adj == old_val)
+	if (current->signal->oom_score_adj == old_val) {
 		current->signal->oom_score_adj = new_val;
+		oom_adj_bucket_update(current);
+	}
 	trace_oom_score_adj_update(current);
 	spin_unlock_irq(&sighand->siglock);
 }
@@ -80,12 +84,229 @@ int test_set_oom_score_adj(int new_val)
 	spin_lock_irq(&sighand->siglock);
 	old_val = current->signal->oom_score_adj;
 	current->signal->oom_score_adj = new_val;
+	oom_adj_bucket_update(current);
 	trace_oom_score_adj_update(current);
 	spin_unlock_irq(&sighand->siglock);
 
 	return old_val;
 }
 
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+/*
+ * Thread group leaders hashed by oom_score_adj, one bucket per value, so
+ * that the low memory killer can go straight to the tasks with the highest
+ * score instead of walking every process in the system.
+ *
+ * Buckets are modified under oom_adj_bucket_lock and walked under RCU.  A
+ * task that changes bucket is unlinked and relinked at once, so a walker
+ * standing on it can be diverted into its new bucket.  Each bucket ends in
+ * a nulls marker holding its index: a walk that ends on another bucket's
+ * marker restarts, see oom_adj_iter_next().  Walkers must still recheck
+ * the oom_score_adj of every task they find.  A bit is set in
+ * oom_adj_bucket_map for each non-empty bucket.
+ */
+#define OOM_ADJ_BUCKETS		(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+
+/* restarts of one bucket before a walk gives up on it */
+#define OOM_ADJ_ITER_RESTARTS	4
+/* entries a walk may see beyond the size of the bucket when it started */
+#define OOM_ADJ_ITER_SLACK	8
+
+static struct hlist_nulls_head oom_adj_buckets[OOM_ADJ_BUCKETS];
+static int oom_adj_bucket_nr[OOM_ADJ_BUCKETS];
+static DECLARE_BITMAP(oom_adj_bucket_map, OOM_ADJ_BUCKETS);
+static DEFINE_SPINLOCK(oom_adj_bucket_lock);
+
+/*
+ * oom_adj_bucket_init() - set up the nulls markers
+ *
+ * Called from fork_init(), before the first task is hashed.
+ */
+void __init oom_adj_bucket_init(void)
+{
+	int b;
+
+	for (b = 0; b < OOM_ADJ_BUCKETS; b++)
+		INIT_HLIST_NULLS_HEAD(&oom_adj_buckets[b], b);
+}
+
+static void __oom_adj_bucket_add(struct task_struct *p)
+{
+	int b = p->signal->oom_score_adj - OOM_SCORE_ADJ_MIN;
+
+	p->oom_adj_bucket = b;
+	hlist_nulls_add_head_rcu(&p->oom_adj_node, &oom_adj_buckets[b]);
+	oom_adj_bucket_nr[b]++;
+	__set_bit(b, oom_adj_bucket_map);
+}
+
+static void __oom_adj_bucket_del(struct task_struct *p)
+{
+	int b = p->oom_adj_bucket;
+
+	if (hlist_nulls_unhashed(&p->oom_adj_node))
+		return;
+	hlist_nulls_del_init_rcu(&p->oom_adj_node);
+	if (!--oom_adj_bucket_nr[b])
+		__clear_bit(b, oom_adj_bucket_map);
+}
+
+/*
+ * oom_adj_bucket_add() - hash a new thread group leader
+ * @p: task being forked, with ->oom_adj_node initialized
+ */
+void oom_adj_bucket_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_bucket_lock, flags);
+	__oom_adj_bucket_add(p);
+	spin_unlock_irqrestore(&oom_adj_bucket_lock, flags);
+}
+
+/*
+ * oom_adj_bucket_del() - unhash an exiting thread group leader
+ * @p: task being released
+ */
+void oom_adj_bucket_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_bucket_lock, flags);
+	__oom_adj_bucket_del(p);
+	spin_unlock_irqrestore(&oom_adj_bucket_lock, flags);
+}
+
+/*
+ * oom_adj_bucket_replace() - hand the bucket entry over to a new leader
+ * @old: previous thread group leader
+ * @new: thread that took over leadership in de_thread()
+ */
+void oom_adj_bucket_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_bucket_lock, flags);
+	__oom_adj_bucket_del(old);
+	__oom_adj_bucket_add(new);
+	spin_unlock_irqrestore(&oom_adj_bucket_lock, flags);
+}
+
+/*
+ * oom_adj_bucket_update() - rehash a process after an oom_score_adj change
+ * @p: any thread of the process, caller holds its ->siglock
+ */
+void oom_adj_bucket_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_bucket_lock, flags);
+	leader = p->group_leader;
+	if (!hlist_nulls_unhashed(&leader->oom_adj_node) &&
+	    leader->oom_adj_bucket !=
+			leader->signal->oom_score_adj - OOM_SCORE_ADJ_MIN) {
+		__oom_adj_bucket_del(leader);
+		__oom_adj_bucket_add(leader);
+	}
+	spin_unlock_irqrestore(&oom_adj_bucket_lock, flags);
+}
+
+/*
+ * oom_adj_bucket_next() - find the highest populated bucket
+ * @oom_score_adj: highest score to consider
+ *
+ * Returns the score of the highest non-empty bucket not above
+ * @oom_score_adj, or OOM_SCORE_ADJ_MIN - 1 if there is none.  The result is
+ * only a hint since buckets can change as soon as it is returned.
+ */
+static int oom_adj_bucket_next(int oom_score_adj)
+{
+	unsigned long size, b;
+
+	if (oom_score_adj < OOM_SCORE_ADJ_MIN)
+		return OOM_SCORE_ADJ_MIN - 1;
+	if (oom_score_adj > OOM_SCORE_ADJ_MAX)
+		oom_score_adj = OOM_SCORE_ADJ_MAX;
+
+	size = oom_score_adj - OOM_SCORE_ADJ_MIN + 1;
+	b = find_last_bit(oom_adj_bucket_map, size);
+	if (b >= size)
+		return OOM_SCORE_ADJ_MIN - 1;
+	return b + OOM_SCORE_ADJ_MIN;
+}
+
+static void oom_adj_iter_start(struct oom_adj_iter *iter)
+{
+	int b = iter->adj - OOM_SCORE_ADJ_MIN;
+
+	iter->pos = rcu_dereference(hlist_nulls_first_rcu(&oom_adj_buckets[b]));
+	/*
+	 * A walker diverted back into this bucket sees its entries again,
+	 * so a task flipping between two buckets could keep it going.
+	 */
+	iter->budget = ACCESS_ONCE(oom_adj_bucket_nr[b]) + OOM_ADJ_ITER_SLACK;
+}
+
+static struct task_struct *__oom_adj_iter_get(struct oom_adj_iter *iter,
+					      bool stop)
+{
+	for (;;) {
+		if (!is_a_nulls(iter->pos) && iter->budget-- > 0)
+			return hlist_nulls_entry(iter->pos, struct task_struct,
+						 oom_adj_node);
+
+		/* walked off into another bucket, or went round too often */
+		if ((!is_a_nulls(iter->pos) || get_nulls_value(iter->pos) !=
+				iter->adj - OOM_SCORE_ADJ_MIN) &&
+		    iter->restarts++ < OOM_ADJ_ITER_RESTARTS) {
+			oom_adj_iter_start(iter);
+			continue;
+		}
+
+		if (stop)
+			return NULL;
+		iter->adj = oom_adj_bucket_next(iter->adj - 1);
+		if (iter->adj < iter->min_adj)
+			return NULL;
+		iter->restarts = 0;
+		oom_adj_iter_start(iter);
+	}
+}
+
+/*
+ * oom_adj_iter_first() - start a walk from the highest oom_score_adj down
+ * @iter: walk cursor
+ * @min_adj: lowest score to walk down to
+ *
+ * Returns the first thread group leader, or NULL if no bucket from
+ * OOM_SCORE_ADJ_MAX down to @min_adj is populated.  Must be called, and
+ * the walk finished, under rcu_read_lock().  Every bucket is walked in
+ * full, but a task may be seen twice or missed while it changes bucket.
+ */
+struct task_struct *oom_adj_iter_first(struct oom_adj_iter *iter, int min_adj)
+{
+	iter->min_adj = min_adj;
+	iter->adj = oom_adj_bucket_next(OOM_SCORE_ADJ_MAX);
+	if (iter->adj < min_adj)
+		return NULL;
+	iter->restarts = 0;
+	oom_adj_iter_start(iter);
+	return __oom_adj_iter_get(iter, false);
+}
+
+/*
+ * oom_adj_iter_next() - continue a walk started by oom_adj_iter_first()
+ * @iter: walk cursor
+ * @stop: end the walk at the end of the current bucket
+ */
+struct task_struct *oom_adj_iter_next(struct oom_adj_iter *iter, bool stop)
+{
+	iter->pos = rcu_dereference(hlist_nulls_next_rcu(iter->pos));
+	return __oom_adj_iter_get(iter, stop);
+}
+#endif
+
 #ifdef CONFIG_NUMA
 /**
  * has_intersects_mems_allowed() - check task eligiblity for kill
@@ -267,8 +267,11 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		if (TestClearPageReadahead(page))
+			count_vm_event(SWAP_RA_HIT);
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
@@ -280,12 +283,14 @@ struct page * lookup_swap_cache(swp_entry_t entry)
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -318,6 +323,19 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * An entry freed into a swap slot cache keeps
+			 * SWAP_HAS_CACHE with no page in the swap cache until
+			 * the cache is drained, which may be never. Nobody
+			 * refers to it any more, so give up rather than spin
+			 * on it. The count reads 0 during swapoff too, but
+			 * then the caches are off and drained, and the entry
+			 * really is on its way into the swap cache.
+			 */
+			if (!__swp_swapcount(entry) &&
+			    swap_slots_cache_enabled())
+				break;
+			cond_resched();
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
@@ -335,6 +353,7 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			 * Initiate read into locked page and return.
 			 */
 			lru_cache_add_anon(new_page);
+			*new_page_allocated = true;
 			swap_readpage(new_page);
 			return new_page;
 		}
@@ -353,6 +372,37 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool page_allocated;
+
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr,
+					&page_allocated);
+}
+
+/*
+ * Start the read of a swap entry in the hope we need it soon.  Pages newly
+ * read in this way are marked PG_readahead, which lookup_swap_cache() clears
+ * again to account a readahead hit.
+ */
+static void swap_readahead_one(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+	bool page_allocated;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+					&page_allocated);
+	if (!page)
+		return;
+	if (page_allocated) {
+		SetPageReadahead(page);
+		count_vm_event(SWAP_RA);
+	}
+	page_cache_release(page);
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -387,13 +437,82 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 		start_offset++;
 
 	for (offset = start_offset; offset <= end_offset ; offset++) {
+		swp_entry_t ra_entry = swp_entry(swp_type(entry), offset);
+
+		if (offset == swp_offset(entry))
+			continue;
+		/* Skip free slots and those held by the swap slot caches */
+		if (!__swp_swapcount(ra_entry))
+			continue;
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
-		if (!page)
+		swap_readahead_one(ra_entry, gfp_mask, vma, addr);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+	return read_swap_cache_async(entry, gfp_mask, vma, addr);
+}
+
+/* upper bound of the ptes looked at by swap_vma_readahead() */
+#define SWAP_RA_VMA_MAX		16
+
+/**
+ * swap_vma_readahead - swap in pages mapped next to the faulting one
+ * @entry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: faulting address
+ * @pmd: pmd whose page table maps @addr
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ *
+ * For swap devices marked SWP_VMA_RA, read ahead the swap entries found in
+ * the ptes around @addr, within the vma and the page table of @addr and
+ * within a (1 << page_cluster) aligned window, instead of the neighbouring
+ * swap offsets: on RAM-backed swap those are mostly unrelated to the
+ * faulting task.  Other devices use swapin_readahead().
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swap_vma_readahead(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	pte_t ptes[SWAP_RA_VMA_MAX];
+	unsigned long win, start, end, ra_addr;
+	unsigned int i, nr;
+	pte_t *pte;
+
+	if (!(swp_swap_info(entry)->flags & SWP_VMA_RA))
+		return swapin_readahead(entry, gfp_mask, vma, addr);
+
+	win = PAGE_SIZE << min_t(unsigned int, page_cluster,
+					ilog2(SWAP_RA_VMA_MAX));
+	start = max3(addr & ~(win - 1), vma->vm_start, addr & PMD_MASK);
+	end = min3((addr & ~(win - 1)) + win, vma->vm_end,
+					(addr & PMD_MASK) + PMD_SIZE);
+	nr = (end - start) >> PAGE_SHIFT;
+	if (nr <= 1)
+		goto out;
+
+	/*
+	 * Snapshot the ptes without the pte lock: a stale or torn entry at
+	 * worst makes us read a slot that nobody needs.
+	 */
+	pte = pte_offset_map(pmd, start);
+	for (i = 0; i < nr; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	for (i = 0, ra_addr = start; i < nr; i++, ra_addr += PAGE_SIZE) {
+		swp_entry_t ra_entry;
+
+		if (ra_addr == addr || !is_swap_pte(ptes[i]))
 			continue;
-		page_cache_release(page);
+		ra_entry = pte_to_swp_entry(ptes[i]);
+		if (non_swap_entry(ra_entry) || !__swp_swapcount(ra_entry))
+			continue;
+		swap_readahead_one(ra_entry, gfp_mask, vma, ra_addr);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
+out:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -32,6 +32,7 @@
 #include <linux/poll.h>
 #include <linux/oom.h>
 #include <linux/export.h>
+#include <linux/cpu.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -42,6 +43,8 @@ static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 				 unsigned char);
 static void free_swap_count_continuations(struct swap_info_struct *);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
+static unsigned char swap_entry_free(struct swap_info_struct *, swp_entry_t,
+				     unsigned char);
 
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
@@ -411,18 +414,28 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n_goal swap entries for the swap cache, all from the
+ * first usable swap type, under a single round of swap_lock.
+ * Returns the number of entries stored in @entries.
+ */
+static int get_swap_pages(int n_goal, swp_entry_t entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
+	long avail;
 	int type, next;
 	int wrapped = 0;
 	int hp_index;
+	int n_ret = 0;
 
 	spin_lock(&swap_lock);
-	if (atomic_long_read(&nr_swap_pages) <= 0)
+	avail = atomic_long_read(&nr_swap_pages);
+	if (avail <= 0)
 		goto noswap;
-	atomic_long_dec(&nr_swap_pages);
+	if (n_goal > avail)
+		n_goal = avail;
+	atomic_long_sub(n_goal, &nr_swap_pages);
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		hp_index = atomic_xchg(&highest_priority_index, -1);
@@ -467,20 +480,220 @@ swp_entry_t get_swap_page(void)
 
 		spin_unlock(&swap_lock);
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
+		while (n_ret < n_goal) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			entries[n_ret++] = swp_entry(type, offset);
+		}
 		spin_unlock(&si->lock);
-		if (offset)
-			return swp_entry(type, offset);
+		if (n_ret)
+			goto out;
 		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
+	spin_unlock(&swap_lock);
+out:
+	if (n_ret < n_goal)
+		atomic_long_add(n_goal - n_ret, &nr_swap_pages);
+	return n_ret;
 
-	atomic_long_inc(&nr_swap_pages);
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return 0;
+}
+
+/*
+ * Per-cpu caches of swap slots, so that swapping out a page does not take
+ * swap_lock and scan the swap map each time, and freeing one does not do
+ * the whole accounting under the swap device lock.
+ *
+ * Slots sitting in a cache are marked SWAP_HAS_CACHE in the swap map but
+ * have no page in the swap cache: cached slots were allocated ahead of
+ * time, returned slots had their last reference dropped and are freed in
+ * a batch once the cache fills up.  swapoff disables and drains the caches
+ * so that try_to_unuse() never meets such a slot.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, cur and nr */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		cur;
+	int		nr;
+	spinlock_t	free_lock;	/* protects slots_ret and n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+static int swap_slots_cache_disabled;	/* # of swapoffs in progress */
+static bool swap_slots_cache_active;	/* rechecked under the cache locks */
+
+/*
+ * Don't let the caches strand free slots when swap is nearly full; below
+ * this watermark slots are allocated and freed directly.
+ */
+static inline bool swap_slots_cache_usable(void)
+{
+	return ACCESS_ONCE(swap_slots_cache_active) &&
+		atomic_long_read(&nr_swap_pages) >
+			num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+/*
+ * Release entries whose swap map only holds SWAP_HAS_CACHE, taking each
+ * swap device lock once per run of entries from the same device.
+ */
+static void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p, *prev = NULL;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		p = swap_info[swp_type(entries[i])];
+		if (p != prev) {
+			if (prev)
+				spin_unlock(&prev->lock);
+			spin_lock(&p->lock);
+			prev = p;
+		}
+		swap_entry_free(p, entries[i], SWAP_HAS_CACHE);
+	}
+	if (prev)
+		spin_unlock(&prev->lock);
+}
+
+static void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	spin_lock(&cache->free_lock);
+	if (!ACCESS_ONCE(swap_slots_cache_active)) {
+		spin_unlock(&cache->free_lock);
+		swapcache_free_entries(&entry, 1);
+		return;
+	}
+	if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	cache->slots_ret[cache->n_ret++] = entry;
+	spin_unlock(&cache->free_lock);
+}
+
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+	cache->cur = 0;
+	cache->nr = 0;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	swapcache_free_entries(cache->slots_ret, cache->n_ret);
+	cache->n_ret = 0;
+	spin_unlock(&cache->free_lock);
+}
+
+static void drain_swap_slots_cache(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+static void disable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slots_cache_disabled++;
+	swap_slots_cache_active = false;
+	drain_swap_slots_cache();
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void enable_swap_slots_cache(bool swapoff_done)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	if (swapoff_done)
+		swap_slots_cache_disabled--;
+	if (!swap_slots_cache_disabled)
+		swap_slots_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/*
+ * Whether freed slots may be parked in the swap slot caches. swapoff turns
+ * the caches off and drains them before try_to_unuse().
+ */
+bool swap_slots_cache_enabled(void)
+{
+	return ACCESS_ONCE(swap_slots_cache_active);
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry = { 0 };
+
+	if (swap_slots_cache_usable()) {
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		mutex_lock(&cache->alloc_lock);
+		if (ACCESS_ONCE(swap_slots_cache_active)) {
+			if (!cache->nr) {
+				cache->cur = 0;
+				cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+							   cache->slots);
+			}
+			if (cache->nr) {
+				entry = cache->slots[cache->cur++];
+				cache->nr--;
+			}
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	if (get_swap_pages(1, &entry))
+		return entry;
+
+	/* the last free slots may be sitting in the per-cpu caches */
+	if (ACCESS_ONCE(swap_slots_cache_active)) {
+		drain_swap_slots_cache();
+		get_swap_pages(1, &entry);
+	}
+	return entry;
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
 }
 
+static int __init swap_slots_cache_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
 /* The only caller of this function is now susupend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
@@ -614,6 +827,29 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 	return usage;
 }
 
+/*
+ * If dropping @usage releases the last reference to @entry, keep the slot
+ * reserved as SWAP_HAS_CACHE instead and let the caller queue it on the
+ * per-cpu cache with free_swap_slot() once p->lock is dropped.
+ */
+static bool swap_entry_defer_free(struct swap_info_struct *p,
+				swp_entry_t entry, unsigned char usage)
+{
+	unsigned char *map = &p->swap_map[swp_offset(entry)];
+	bool last;
+
+	if (usage == SWAP_HAS_CACHE)
+		last = *map == SWAP_HAS_CACHE;
+	else
+		last = *map == 1 || *map == SWAP_MAP_SHMEM;
+
+	if (!last || !swap_slots_cache_usable())
+		return false;
+
+	*map = SWAP_HAS_CACHE;
+	return true;
+}
+
 /*
  * Caller has made sure that the swapdevice corresponding to entry
  * is still around or has not been recycled.
@@ -621,11 +857,16 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	bool defer;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
+		defer = swap_entry_defer_free(p, entry, 1);
+		if (!defer)
+			swap_entry_free(p, entry, 1);
 		spin_unlock(&p->lock);
+		if (defer)
+			free_swap_slot(entry);
 	}
 }
 
@@ -635,17 +876,41 @@ void swap_free(swp_entry_t entry)
 void swapcache_free(swp_entry_t entry, struct page *page)
 {
 	struct swap_info_struct *p;
-	unsigned char count;
+	unsigned char count = 0;
+	bool defer;
 
 	p = swap_info_get(entry);
 	if (p) {
-		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
+		defer = swap_entry_defer_free(p, entry, SWAP_HAS_CACHE);
+		if (!defer)
+			count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
 		spin_unlock(&p->lock);
+		if (defer)
+			free_swap_slot(entry);
 	}
 }
 
+/*
+ * Lockless peek at the references to a swap entry, not counting the swap
+ * cache nor count continuations.  Slots held by the swap slot caches read
+ * as 0, which lets swap readahead skip them.
+ */
+int __swp_swapcount(swp_entry_t entry)
+{
+	struct swap_info_struct *si;
+	pgoff_t offset = swp_offset(entry);
+	unsigned int type = swp_type(entry);
+
+	if (type >= nr_swapfiles)
+		return 0;
+	si = swap_info[type];
+	if (!(si->flags & SWP_WRITEOK) || offset >= si->max)
+		return 0;
+	return swap_count(ACCESS_ONCE(si->swap_map[offset]));
+}
+
 /*
  * How many references to page are currently swapped out?
  * This does not give an exact answer when swap count is continued,
@@ -1669,9 +1934,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
+	disable_swap_slots_cache();
 	oom_score_adj = test_set_oom_score_adj(OOM_SCORE_ADJ_MAX);
 	err = try_to_unuse(type);
 	compare_swap_oom_score_adj(OOM_SCORE_ADJ_MAX, oom_score_adj);
+	enable_swap_slots_cache(true);
 
 	if (err) {
 		/*
@@ -2169,7 +2436,15 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		}
 		if ((swap_flags & SWAP_FLAG_DISCARD) && discard_swap(p) == 0)
 			p->flags |= SWP_DISCARDABLE;
+		/*
+		 * Neighbouring slots of a RAM-backed device such as zram
+		 * hold unrelated pages, each costing a decompression.
+		 */
+		if (p->bdev->bd_disk->fops->swap_slot_free_notify)
+			p->flags |= SWP_VMA_RA;
 	}
+	if (swap_flags & SWAP_FLAG_VMA_RA)
+		p->flags |= SWP_VMA_RA;
 
 	mutex_lock(&swapon_mutex);
 	prio = -1;
@@ -2179,13 +2454,15 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	enable_swap_info(p, prio, swap_map);
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
-			"Priority:%d extents:%d across:%lluk %s%s\n",
+			"Priority:%d extents:%d across:%lluk %s%s%s\n",
 		p->pages<<(PAGE_SHIFT-10), name, p->prio,
 		nr_extents, (unsigned long long)span<<(PAGE_SHIFT-10),
 		(p->flags & SWP_SOLIDSTATE) ? "SS" : "",
-		(p->flags & SWP_DISCARDABLE) ? "D" : "");
+		(p->flags & SWP_DISCARDABLE) ? "D" : "",
+		(p->flags & SWP_VMA_RA) ? "V" : "");
 
 	mutex_unlock(&swapon_mutex);
+	enable_swap_slots_cache(false);
 	atomic_inc(&proc_poll_event);
 	wake_up_interruptible(&proc_poll_wait);
 
@@ -2358,6 +2635,20 @@ struct swap_info_struct *page_swap_info(struct page *page)
 	return swap_info[swp_type(swap)];
 }
 
+/*
+ * No reference on the entry or its device is needed: swap_info_structs are
+ * never freed, and a device that is swapped off and on again meanwhile
+ * just reuses the same struct.  Callers (do_swap_page() through
+ * swap_vma_readahead()) do not pin the device, so they must only use
+ * this for policy decisions such as reading ->flags, and must tolerate
+ * their answer being stale; anything touching ->swap_map or the backing
+ * file goes through the locked swap map helpers.
+ */
+struct swap_info_struct *swp_swap_info(swp_entry_t entry)
+{
+	return swap_info[swp_type(entry)];
+}
+
 /*
  * out-of-line __page_file_ methods to avoid include hell.
  */
@@ -721,6 +721,11 @@ static enum page_references page_check_references(struct page *page,
 
 /*
  * shrink_page_list() returns the number of reclaimed pages
+ *
+ * Dirty swap cache pages are not written out as they are met: they stay
+ * locked on a local list until all the pages have been through the rmap
+ * walks, and are then paged out back to back in a second pass, so that
+ * the swap writes of the whole batch reach the device together.
  */
 static unsigned long shrink_page_list(struct list_head *page_list,
 				      struct zone *zone,
@@ -732,6 +737,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
+	LIST_HEAD(swap_pages);
+	bool write_swap_pages = false;
 	int pgactivate = 0;
 	unsigned long nr_dirty = 0;
 	unsigned long nr_congested = 0;
@@ -740,6 +747,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 
 	cond_resched();
 
+restart:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -751,6 +759,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		page = lru_to_page(page_list);
 		list_del(&page->lru);
 
+		/* Deferred swap cache page, still locked and unmapped */
+		if (write_swap_pages) {
+			mapping = page_mapping(page);
+			goto write_page;
+		}
+
 		if (!trylock_page(page))
 			goto keep;
 
@@ -852,6 +866,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
+			/* Write swap out once the whole batch is unmapped */
+			if (PageSwapCache(page)) {
+				list_add(&page->lru, &swap_pages);
+				continue;
+			}
+write_page:
 			/* Page is dirty, try to write it out here */
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
@@ -963,6 +983,12 @@ keep:
 		VM_BUG_ON(PageLRU(page) || PageUnevictable(page));
 	}
 
+	if (!list_empty(&swap_pages)) {
+		list_splice_init(&swap_pages, page_list);
+		write_swap_pages = true;
+		goto restart;
+	}
+
 	/*
 	 * Tag a zone as congested if all the dirty pages encountered were
 	 * backed by a congested BDI. In this case, reclaimers should just
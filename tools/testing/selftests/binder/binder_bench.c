@@ -0,0 +1,547 @@
+/*
+ * binder transaction throughput and latency benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Runs 1, 2, 4, ... independent client/server process pairs, each client
+ * doing synchronous transactions to its own server, and reports the
+ * aggregate transaction rate and the client-side round trip latency for
+ * every pair count. Pairs share no binder objects, so with per-proc
+ * locking the rate should scale with the number of cores.
+ *
+ * The benchmark acts as its own context manager to hand out the server
+ * handles, so it cannot run while servicemanager owns /dev/binder; stop
+ * it first on an Android system.
+ *
+ * usage: binder_bench [-p max pairs] [-n transactions] [-s payload bytes]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAYLOAD	4096
+#define HIST_US		10000	/* 1us latency buckets, last one overflow */
+
+enum {
+	CMD_REGISTER = 1,	/* server -> manager: idx, binder object */
+	CMD_LOOKUP,		/* client -> manager: idx, returns handle */
+	CMD_PING,		/* client -> server */
+	CMD_QUIT,		/* client -> server, server exits */
+};
+
+struct binder_ctx {
+	int fd;
+	void *map;
+	unsigned char wbuf[256];	/* commands queued for the next ioctl */
+	size_t wlen;
+	unsigned char rbuf[256];	/* returns not parsed yet */
+	size_t rpos, rlen;
+};
+
+struct client_result {
+	double elapsed;
+	uint64_t count;
+	uint32_t hist[HIST_US];
+	int err;
+};
+
+struct shared {
+	volatile int ready;
+	struct client_result res[];
+};
+
+static int iterations = 10000;
+static size_t payload = 32;
+static struct shared *shared;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int binder_ctx_open(struct binder_ctx *ctx)
+{
+	struct binder_version vers;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->fd = open(BINDER_DEV, O_RDWR);
+	if (ctx->fd < 0)
+		return -errno;
+	if (ioctl(ctx->fd, BINDER_VERSION, &vers) ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		close(ctx->fd);
+		return -EPROTO;
+	}
+	ctx->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+	if (ctx->map == MAP_FAILED) {
+		close(ctx->fd);
+		return -errno;
+	}
+	return 0;
+}
+
+static void queue_cmd(struct binder_ctx *ctx, uint32_t cmd,
+		      const void *arg, size_t size)
+{
+	memcpy(ctx->wbuf + ctx->wlen, &cmd, sizeof(cmd));
+	memcpy(ctx->wbuf + ctx->wlen + sizeof(cmd), arg, size);
+	ctx->wlen += sizeof(cmd) + size;
+}
+
+/* Write the queued commands and, if @read, wait for new returns. */
+static int binder_io(struct binder_ctx *ctx, int read)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)ctx->wbuf;
+	bwr.write_size = ctx->wlen;
+	if (read) {
+		bwr.read_buffer = (unsigned long)ctx->rbuf;
+		bwr.read_size = sizeof(ctx->rbuf);
+	}
+	if (ioctl(ctx->fd, BINDER_WRITE_READ, &bwr) < 0)
+		return -errno;
+	ctx->wlen = 0;
+	if (read) {
+		ctx->rpos = 0;
+		ctx->rlen = bwr.read_consumed;
+	}
+	return 0;
+}
+
+/*
+ * Fetch the next transaction, reply or transaction complete into @cmdp,
+ * answering the reference count requests for our own node on the way.
+ */
+static int next_return(struct binder_ctx *ctx,
+		       struct binder_transaction_data *tr, uint32_t *cmdp)
+{
+	struct binder_ptr_cookie pc;
+	uint32_t cmd;
+	int ret;
+
+	for (;;) {
+		if (ctx->rpos >= ctx->rlen) {
+			ret = binder_io(ctx, 1);
+			if (ret)
+				return ret;
+			continue;
+		}
+		memcpy(&cmd, ctx->rbuf + ctx->rpos, sizeof(cmd));
+		ctx->rpos += sizeof(cmd);
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_TRANSACTION_COMPLETE:
+			*cmdp = cmd;
+			return 0;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(tr, ctx->rbuf + ctx->rpos, sizeof(*tr));
+			ctx->rpos += sizeof(*tr);
+			*cmdp = cmd;
+			return 0;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			memcpy(&pc, ctx->rbuf + ctx->rpos, sizeof(pc));
+			ctx->rpos += sizeof(pc);
+			queue_cmd(ctx, cmd == BR_INCREFS ? BC_INCREFS_DONE :
+				  BC_ACQUIRE_DONE, &pc, sizeof(pc));
+			ret = binder_io(ctx, 0);
+			if (ret)
+				return ret;
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			ctx->rpos += sizeof(pc);
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			return -EPIPE;
+		default:
+			fprintf(stderr, "unexpected binder return 0x%x\n", cmd);
+			return -EPROTO;
+		}
+	}
+}
+
+static void queue_free(struct binder_ctx *ctx,
+		       struct binder_transaction_data *tr)
+{
+	queue_cmd(ctx, BC_FREE_BUFFER, &tr->data.ptr.buffer, sizeof(void *));
+}
+
+/* Synchronous transaction; the caller frees @reply with queue_free(). */
+static int transact(struct binder_ctx *ctx, uint32_t handle, uint32_t code,
+		    const void *data, size_t size, const size_t *offsets,
+		    size_t nr_offsets, struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data tr;
+	uint32_t cmd;
+	int ret;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = size;
+	tr.offsets_size = nr_offsets * sizeof(size_t);
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	queue_cmd(ctx, BC_TRANSACTION, &tr, sizeof(tr));
+
+	do {
+		ret = next_return(ctx, reply, &cmd);
+		if (ret)
+			return ret;
+	} while (cmd == BR_TRANSACTION_COMPLETE);
+	return cmd == BR_REPLY ? 0 : -EPROTO;
+}
+
+static void queue_reply(struct binder_ctx *ctx, const void *data, size_t size,
+			const size_t *offsets, size_t nr_offsets)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.data_size = size;
+	tr.offsets_size = nr_offsets * sizeof(size_t);
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	queue_cmd(ctx, BC_REPLY, &tr, sizeof(tr));
+}
+
+static void enter_looper(struct binder_ctx *ctx)
+{
+	uint32_t cmd = BC_ENTER_LOOPER;
+
+	memcpy(ctx->wbuf + ctx->wlen, &cmd, sizeof(cmd));
+	ctx->wlen += sizeof(cmd);
+}
+
+struct register_msg {
+	uint32_t idx;
+	struct flat_binder_object obj;
+};
+
+static void server(int idx)
+{
+	static const size_t offsets[] = {
+		offsetof(struct register_msg, obj),
+	};
+	struct binder_transaction_data tr;
+	struct register_msg msg;
+	struct binder_ctx ctx;
+	uint32_t cmd;
+
+	if (binder_ctx_open(&ctx))
+		exit(1);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.idx = idx;
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	msg.obj.binder = &ctx;
+	msg.obj.cookie = &ctx;
+	if (transact(&ctx, 0, CMD_REGISTER, &msg, sizeof(msg), offsets, 1, &tr))
+		exit(1);
+	queue_free(&ctx, &tr);
+	enter_looper(&ctx);
+
+	for (;;) {
+		if (next_return(&ctx, &tr, &cmd))
+			exit(1);
+		if (cmd == BR_TRANSACTION_COMPLETE)
+			continue;
+		if (cmd != BR_TRANSACTION)
+			exit(1);
+		queue_free(&ctx, &tr);
+		queue_reply(&ctx, NULL, 0, NULL, 0);
+		if (tr.code == CMD_QUIT)
+			break;
+	}
+	/* push the last reply out before exiting */
+	binder_io(&ctx, 0);
+	exit(0);
+}
+
+static void client(int idx)
+{
+	struct client_result *res = &shared->res[idx];
+	struct flat_binder_object obj;
+	struct binder_transaction_data tr;
+	struct binder_ctx ctx;
+	char data[MAX_PAYLOAD];
+	uint32_t handle, lookup = idx;
+	double start, t;
+	int i, ret;
+
+	ret = binder_ctx_open(&ctx);
+	if (ret)
+		goto fail;
+
+	ret = transact(&ctx, 0, CMD_LOOKUP, &lookup, sizeof(lookup),
+		       NULL, 0, &tr);
+	if (ret)
+		goto fail;
+	if (tr.data_size < sizeof(obj)) {
+		ret = -EPROTO;
+		goto fail;
+	}
+	memcpy(&obj, tr.data.ptr.buffer, sizeof(obj));
+	handle = obj.handle;
+	queue_cmd(&ctx, BC_ACQUIRE, &handle, sizeof(handle));
+	queue_free(&ctx, &tr);
+
+	memset(data, 0x5a, sizeof(data));
+	__sync_fetch_and_sub(&shared->ready, 1);
+	while (shared->ready)
+		sched_yield();
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		t = now();
+		ret = transact(&ctx, handle, CMD_PING, data, payload,
+			       NULL, 0, &tr);
+		if (ret)
+			goto fail;
+		queue_free(&ctx, &tr);
+		t = (now() - t) * 1e6;
+		res->hist[t < HIST_US - 1 ? (int)t : HIST_US - 1]++;
+	}
+	res->elapsed = now() - start;
+	res->count = iterations;
+
+	ret = transact(&ctx, handle, CMD_QUIT, NULL, 0, NULL, 0, &tr);
+	if (ret)
+		goto fail;
+	queue_free(&ctx, &tr);
+	binder_io(&ctx, 0);
+	exit(0);
+fail:
+	res->err = -ret;
+	/* don't leave the others waiting at the start line */
+	if (shared->ready)
+		__sync_fetch_and_sub(&shared->ready, 1);
+	exit(1);
+}
+
+/* Serve @nr requests of type @code as the context manager. */
+static int serve(struct binder_ctx *ctx, uint32_t code, int nr,
+		 uint32_t *handles)
+{
+	static struct flat_binder_object reply_obj;
+	static const size_t reply_offsets[] = { 0 };
+	struct binder_transaction_data tr;
+	struct register_msg msg;
+	uint32_t idx, cmd;
+	int ret;
+
+	while (nr) {
+		ret = next_return(ctx, &tr, &cmd);
+		if (ret)
+			return ret;
+		if (cmd == BR_TRANSACTION_COMPLETE)
+			continue;
+		if (cmd != BR_TRANSACTION)
+			return -EPROTO;
+
+		if (tr.code != code) {
+			queue_free(ctx, &tr);
+			queue_reply(ctx, NULL, 0, NULL, 0);
+			continue;
+		}
+		if (code == CMD_REGISTER) {
+			memcpy(&msg, tr.data.ptr.buffer, sizeof(msg));
+			handles[msg.idx] = msg.obj.handle;
+			/* keep the reference once the buffer is freed */
+			queue_cmd(ctx, BC_ACQUIRE, &handles[msg.idx],
+				  sizeof(uint32_t));
+			queue_free(ctx, &tr);
+			queue_reply(ctx, NULL, 0, NULL, 0);
+		} else {
+			memcpy(&idx, tr.data.ptr.buffer, sizeof(idx));
+			memset(&reply_obj, 0, sizeof(reply_obj));
+			reply_obj.type = BINDER_TYPE_HANDLE;
+			reply_obj.handle = handles[idx];
+			queue_free(ctx, &tr);
+			queue_reply(ctx, &reply_obj, sizeof(reply_obj),
+				    reply_offsets, 1);
+		}
+		/* flush now, reply_obj is reused by the next request */
+		ret = binder_io(ctx, 0);
+		if (ret)
+			return ret;
+		nr--;
+	}
+	return 0;
+}
+
+static double percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t want = total * pct / 100, seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_US; i++) {
+		seen += hist[i];
+		if (seen > want)
+			return i;
+	}
+	return HIST_US;
+}
+
+static int run_round(struct binder_ctx *ctx, int pairs)
+{
+	uint32_t *handles = calloc(pairs, sizeof(*handles));
+	uint64_t *hist = calloc(HIST_US, sizeof(*hist));
+	uint64_t total = 0, sum_us = 0;
+	double elapsed = 0;
+	pid_t pid;
+	int i, j, ret, status, failed = 0;
+
+	if (!handles || !hist)
+		return -ENOMEM;
+	memset(shared->res, 0, pairs * sizeof(shared->res[0]));
+	shared->ready = pairs;
+	alarm(300);
+
+	for (i = 0; i < pairs; i++) {
+		pid = fork();
+		if (pid < 0)
+			return -errno;
+		if (!pid)
+			server(i);
+	}
+	ret = serve(ctx, CMD_REGISTER, pairs, handles);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < pairs; i++) {
+		pid = fork();
+		if (pid < 0)
+			return -errno;
+		if (!pid)
+			client(i);
+	}
+	ret = serve(ctx, CMD_LOOKUP, pairs, handles);
+	if (ret)
+		return ret;
+
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	alarm(0);
+
+	for (i = 0; i < pairs; i++) {
+		struct client_result *res = &shared->res[i];
+
+		if (res->err) {
+			fprintf(stderr, "client %d: %s\n", i,
+				strerror(res->err));
+			failed = 1;
+		}
+		total += res->count;
+		if (res->elapsed > elapsed)
+			elapsed = res->elapsed;
+		for (j = 0; j < HIST_US; j++) {
+			hist[j] += res->hist[j];
+			sum_us += (uint64_t)res->hist[j] * j;
+		}
+	}
+	if (failed || !total)
+		return -EIO;
+
+	printf("%-6d %12.0f %10.1f %8.0f %8.0f\n", pairs, total / elapsed,
+	       (double)sum_us / total, percentile(hist, total, 50),
+	       percentile(hist, total, 99));
+	free(handles);
+	free(hist);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int max_pairs = sysconf(_SC_NPROCESSORS_ONLN);
+	struct binder_ctx ctx;
+	int opt, pairs, ret;
+
+	while ((opt = getopt(argc, argv, "p:n:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			max_pairs = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			if (payload > MAX_PAYLOAD)
+				payload = MAX_PAYLOAD;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-p pairs] [-n transactions] [-s bytes]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_pairs < 1)
+		max_pairs = 1;
+
+	ret = binder_ctx_open(&ctx);
+	if (ret) {
+		printf("%s: %s, skipping\n", BINDER_DEV, strerror(-ret));
+		return 0;
+	}
+	if (ioctl(ctx.fd, BINDER_SET_CONTEXT_MGR, 0)) {
+		printf("cannot become context manager (%s), skipping\n",
+		       strerror(errno));
+		return 0;
+	}
+	enter_looper(&ctx);
+
+	shared = mmap(NULL, sizeof(*shared) +
+		      max_pairs * sizeof(shared->res[0]),
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	printf("%-6s %12s %10s %8s %8s\n",
+	       "pairs", "txn/s", "avg us", "p50 us", "p99 us");
+	for (pairs = 1; ; pairs *= 2) {
+		if (pairs > max_pairs)
+			pairs = max_pairs;
+		ret = run_round(&ctx, pairs);
+		if (ret) {
+			printf("%d pairs: %s\n", pairs, strerror(-ret));
+			return 1;
+		}
+		if (pairs == max_pairs)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * f2fs atomic write commit benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Runs transactions the way SQLite does on f2fs: start an atomic write,
+ * overwrite a number of scattered pages of the database file, commit.
+ * Reports the mean and worst commit latency for transactions of 1, 4,
+ * 16 and 64 pages.
+ *
+ * usage: atomic_bench [-d directory on f2fs] [-s file size in MB]
+ *                     [-n transactions per size]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+/* from fs/f2fs/f2fs.h */
+#define F2FS_SUPER_MAGIC		0xF2F52010
+#define F2FS_IOCTL_MAGIC		0xf5
+#define F2FS_IOC_START_ATOMIC_WRITE	_IO(F2FS_IOCTL_MAGIC, 1)
+#define F2FS_IOC_COMMIT_ATOMIC_WRITE	_IO(F2FS_IOCTL_MAGIC, 2)
+
+#define PAGE_SZ		4096
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int transaction(int fd, char *buf, int pages, long nr_pages,
+		       double *commit)
+{
+	double start;
+	int i;
+
+	if (ioctl(fd, F2FS_IOC_START_ATOMIC_WRITE))
+		return -1;
+	for (i = 0; i < pages; i++) {
+		off_t off = (off_t)(random() % nr_pages) * PAGE_SZ;
+
+		buf[0]++;
+		if (pwrite(fd, buf, PAGE_SZ, off) != PAGE_SZ)
+			return -1;
+	}
+	start = now();
+	if (ioctl(fd, F2FS_IOC_COMMIT_ATOMIC_WRITE))
+		return -1;
+	*commit = now() - start;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 1, 4, 16, 64 };
+	const char *base = "/data";
+	char path[4200], *buf;
+	struct statfs sfs;
+	long nr_pages, size_mb = 64;
+	int opt, fd, i, j, nr = 200, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:s:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 's':
+			size_mb = atol(optarg);
+			break;
+		case 'n':
+			nr = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d directory] [-s MB] [-n transactions]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (size_mb < 1)
+		size_mb = 1;
+	if (nr < 1)
+		nr = 1;
+	nr_pages = size_mb * (1024 * 1024 / PAGE_SZ);
+
+	if (statfs(base, &sfs)) {
+		printf("%s: %s, skipping\n", base, strerror(errno));
+		return 0;
+	}
+	if (sfs.f_type != F2FS_SUPER_MAGIC) {
+		printf("%s is not on f2fs, skipping\n", base);
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "%s/atomic_bench.%d", base, getpid());
+	fd = open(path, O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		printf("%s: %s, skipping\n", path, strerror(errno));
+		return 0;
+	}
+	buf = malloc(PAGE_SZ);
+	if (!buf) {
+		ret = 1;
+		goto out;
+	}
+	memset(buf, 0x5a, PAGE_SZ);
+
+	/* lay the whole file out first, so commits overwrite real blocks */
+	for (i = 0; i < nr_pages; i++) {
+		if (pwrite(fd, buf, PAGE_SZ, (off_t)i * PAGE_SZ) != PAGE_SZ) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			ret = 1;
+			goto out;
+		}
+	}
+	fsync(fd);
+
+	printf("%ld MB file, %d transactions per size\n", size_mb, nr);
+	printf("%-6s %14s %14s\n", "pages", "mean (us)", "max (us)");
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		double commit, total = 0, max = 0;
+
+		for (j = 0; j < nr; j++) {
+			if (transaction(fd, buf, sizes[i], nr_pages, &commit)) {
+				fprintf(stderr, "%s: %s\n", path,
+					strerror(errno));
+				ret = 1;
+				goto out;
+			}
+			total += commit;
+			if (commit > max)
+				max = commit;
+		}
+		printf("%-6d %14.1f %14.1f\n", sizes[i], total * 1e6 / nr,
+		       max * 1e6);
+	}
+
+out:
+	free(buf);
+	close(fd);
+	unlink(path);
+	return ret;
+}
@@ -0,0 +1,184 @@
+/*
+ * Android logger concurrent writer benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Writes log entries from 1, 2, 4, ... threads, each with its own file
+ * descriptor as separate processes would have, and reports the aggregate
+ * entry rate for each thread count.  With -r, a reader drains the log at
+ * the same time, so writers also race with the reader side.
+ *
+ * The entries land in the real log, tagged "logger_bench".
+ *
+ * usage: logger_bench [-d device] [-t max threads] [-n entries per thread]
+ *                     [-s message bytes] [-r]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_MSG		4000
+#define ANDROID_LOG_INFO	4
+
+static const char *device = "/dev/log/main";
+static int entries = 100000;
+static size_t msg_len = 64;
+static volatile int reading;
+
+struct writer {
+	pthread_t thread;
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_fn(void *arg)
+{
+	static const char tag[] = "logger_bench";
+	struct writer *w = arg;
+	unsigned char prio = ANDROID_LOG_INFO;
+	char msg[MAX_MSG + 1];
+	struct iovec iov[3];
+	int fd, i;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		w->err = errno;
+		return NULL;
+	}
+	memset(msg, 'x', msg_len);
+	msg[msg_len] = '\0';
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *)tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msg_len + 1;
+
+	for (i = 0; i < entries; i++) {
+		if (writev(fd, iov, 3) < 0) {
+			w->err = errno;
+			break;
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+static void *reader_fn(void *arg)
+{
+	char buf[5 * 1024];
+	int fd;
+
+	(void)arg;
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+	while (reading) {
+		if (read(fd, buf, sizeof(buf)) < 0 && errno == EAGAIN)
+			usleep(1000);
+	}
+	close(fd);
+	return NULL;
+}
+
+static int run(int nr, double *rate)
+{
+	struct writer *w = calloc(nr, sizeof(*w));
+	double start;
+	int i, err = 0;
+
+	if (!w)
+		return ENOMEM;
+	start = now();
+	for (i = 0; i < nr; i++)
+		pthread_create(&w[i].thread, NULL, writer_fn, &w[i]);
+	for (i = 0; i < nr; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (w[i].err)
+			err = w[i].err;
+	}
+	*rate = (double)nr * entries / (now() - start);
+	free(w);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t reader;
+	int opt, nr, err, with_reader = 0;
+	double rate;
+
+	while ((opt = getopt(argc, argv, "d:t:n:s:r")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		case 's':
+			msg_len = strtoul(optarg, NULL, 0);
+			if (msg_len > MAX_MSG)
+				msg_len = MAX_MSG;
+			break;
+		case 'r':
+			with_reader = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d device] [-t threads] [-n entries] [-s bytes] [-r]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1)
+		max_threads = 1;
+
+	if (access(device, W_OK)) {
+		printf("%s: %s, skipping\n", device, strerror(errno));
+		return 0;
+	}
+	if (with_reader) {
+		reading = 1;
+		pthread_create(&reader, NULL, reader_fn, NULL);
+	}
+
+	printf("%-8s %14s\n", "threads", "entries/s");
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max_threads)
+			nr = max_threads;
+		err = run(nr, &rate);
+		if (err) {
+			printf("%d threads: %s\n", nr, strerror(err));
+			break;
+		}
+		printf("%-8d %14.0f\n", nr, rate);
+		if (nr == max_threads)
+			break;
+	}
+
+	if (with_reader) {
+		reading = 0;
+		pthread_join(reader, NULL);
+	}
+	return err ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * lowmemorykiller shrinker cost against process count
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Forks 0, N, 2N, ... idle processes spread over oom_score_adj 0..999 and
+ * times "echo 2 > /proc/sys/vm/drop_caches", which calls every shrinker,
+ * lowmem_shrink() among them, many times over.  The low memory killer is
+ * tuned so that it always looks for a victim but only at oom_score_adj
+ * 1000: it has to run its victim selection on every call yet never finds
+ * anything to kill.  Selection that walks every process gets slower as
+ * processes are added; selection from oom_score_adj buckets does not.
+ *
+ * Since anything at oom_score_adj 1000 would be killed, the benchmark
+ * refuses to run while such a process exists.  The tunables are restored
+ * on exit.
+ *
+ * usage: lmk_bench [-n step] [-m max processes] [-r repeats]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LMK_PARAM	"/sys/module/lowmemorykiller/parameters/"
+#define DROP_CACHES	"/proc/sys/vm/drop_caches"
+
+struct param {
+	const char *name;
+	const char *bench_value;
+	char saved[256];
+	int have;
+};
+
+static struct param params[] = {
+	{ .name = "adj", .bench_value = "1000" },
+	{ .name = "minfree", .bench_value = "1000000000" },
+	{ .name = "enable_adaptive_lmk", .bench_value = "0" },
+};
+
+#define NR_PARAMS	(sizeof(params) / sizeof(params[0]))
+
+static pid_t *children;
+static int nr_children;
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t len;
+
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+	buf[len] = '\0';
+	return 0;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+	ssize_t len;
+
+	if (fd < 0)
+		return -errno;
+	len = write(fd, val, strlen(val));
+	close(fd);
+	return len < 0 ? -errno : 0;
+}
+
+static void restore(void)
+{
+	unsigned int i;
+	char path[128];
+
+	for (i = 0; i < NR_PARAMS; i++) {
+		if (!params[i].have)
+			continue;
+		snprintf(path, sizeof(path), LMK_PARAM "%s", params[i].name);
+		write_file(path, params[i].saved);
+	}
+	for (i = 0; i < (unsigned int)nr_children; i++)
+		kill(children[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+	nr_children = 0;
+}
+
+static void on_signal(int sig)
+{
+	restore();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/* Anything at oom_score_adj 1000 would be the victim. */
+static int find_adj_max(void)
+{
+	struct dirent *de;
+	char path[300], buf[16];
+	DIR *dir = opendir("/proc");
+	int found = 0;
+
+	if (!dir)
+		return -errno;
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/oom_score_adj",
+			 de->d_name);
+		if (!read_file(path, buf, sizeof(buf)) && atoi(buf) >= 1000) {
+			printf("pid %s has oom_score_adj %d\n",
+			       de->d_name, atoi(buf));
+			found = 1;
+		}
+	}
+	closedir(dir);
+	return found;
+}
+
+static int spawn(int nr)
+{
+	char path[64], adj[16];
+	pid_t pid;
+
+	while (nr_children < nr) {
+		pid = fork();
+		if (pid < 0)
+			return -errno;
+		if (!pid) {
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			for (;;)
+				pause();
+		}
+		snprintf(path, sizeof(path), "/proc/%d/oom_score_adj", pid);
+		snprintf(adj, sizeof(adj), "%d", nr_children * 37 % 1000);
+		children[nr_children++] = pid;
+		if (write_file(path, adj))
+			return -EIO;
+	}
+	return 0;
+}
+
+static double drop_slab_ms(void)
+{
+	struct timespec a, b;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	write_file(DROP_CACHES, "2");
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	int step = 100, max = 800, repeats = 7;
+	char path[128];
+	double *t, base = 0;
+	unsigned int i;
+	int opt, nr, r, ret;
+
+	while ((opt = getopt(argc, argv, "n:m:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			step = atoi(optarg);
+			break;
+		case 'm':
+			max = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n step] [-m max] [-r repeats]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (step < 1 || max < 0 || repeats < 1) {
+		fprintf(stderr, "invalid arguments\n");
+		return 1;
+	}
+
+	if (access(LMK_PARAM "minfree", W_OK) || access(DROP_CACHES, W_OK)) {
+		printf("lowmemorykiller tunables not writable, skipping\n");
+		return 0;
+	}
+	ret = find_adj_max();
+	if (ret) {
+		printf("processes at oom_score_adj 1000 would be killed, skipping\n");
+		return 0;
+	}
+
+	children = calloc(max + 1, sizeof(*children));
+	t = calloc(repeats, sizeof(*t));
+	if (!children || !t)
+		return 1;
+
+	for (i = 0; i < NR_PARAMS; i++) {
+		snprintf(path, sizeof(path), LMK_PARAM "%s", params[i].name);
+		if (read_file(path, params[i].saved, sizeof(params[i].saved)))
+			continue;
+		params[i].have = 1;
+		if (write_file(path, params[i].bench_value)) {
+			fprintf(stderr, "cannot set %s\n", params[i].name);
+			restore();
+			return 1;
+		}
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	printf("%-10s %12s %12s %12s\n",
+	       "processes", "min ms", "median ms", "delta ms");
+	for (nr = 0; nr <= max; nr += step) {
+		ret = spawn(nr);
+		if (ret) {
+			fprintf(stderr, "fork: %s\n", strerror(-ret));
+			restore();
+			return 1;
+		}
+		/* the first pass also drops whatever slab was cached */
+		drop_slab_ms();
+		for (r = 0; r < repeats; r++)
+			t[r] = drop_slab_ms();
+		qsort(t, repeats, sizeof(*t), cmp_double);
+		if (!nr)
+			base = t[repeats / 2];
+		printf("%-10d %12.2f %12.2f %12.2f\n", nr, t[0],
+		       t[repeats / 2], t[repeats / 2] - base);
+	}
+
+	restore();
+	return 0;
+}
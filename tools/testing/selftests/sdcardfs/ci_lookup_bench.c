@@ -0,0 +1,155 @@
+/*
+ * sdcardfs case-insensitive lookup benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Creates a directory with many entries on an sdcardfs mount and times
+ * stat() of names which miss the exact-case lookup in the lower directory:
+ * existing names in the wrong case, and names which do not exist at all.
+ * Every round uses names not seen before, so each stat() reaches
+ * sdcardfs_lookup() instead of being answered from the dcache.
+ *
+ * usage: ci_lookup_bench [-d directory on sdcardfs] [-n entries]
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SDCARDFS_SUPER_MAGIC	0xb550ca10
+#define PREFIX			"entry"
+#define ROUNDS			4	/* distinct wrong cases of PREFIX */
+
+static char dir[4096];
+static int entries = 10000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* spell PREFIX with the case pattern 'mask' */
+static void name(char *buf, size_t size, const char *prefix,
+		 unsigned int mask, int i)
+{
+	size_t j;
+
+	snprintf(buf, size, "%s/%s%06d", dir, prefix, i);
+	for (j = 0; j < strlen(prefix); j++) {
+		char *c = buf + strlen(dir) + 1 + j;
+
+		if (mask & (1U << j))
+			*c = toupper(*c);
+	}
+}
+
+static double time_stats(const char *prefix, unsigned int mask, int want)
+{
+	char path[4200];
+	struct stat st;
+	double start;
+	int i, ret;
+
+	start = now();
+	for (i = 0; i < entries; i++) {
+		name(path, sizeof(path), prefix, mask, i);
+		ret = stat(path, &st) ? errno : 0;
+		if (ret != want) {
+			fprintf(stderr, "%s: %s\n", path, strerror(ret));
+			return -1;
+		}
+	}
+	return (now() - start) * 1e6 / entries;
+}
+
+static void cleanup(void)
+{
+	char path[4200];
+	int i;
+
+	for (i = 0; i < entries; i++) {
+		name(path, sizeof(path), PREFIX, 0, i);
+		unlink(path);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+	const char *base = "/sdcard";
+	char path[4200], missing[16];
+	struct statfs sfs;
+	unsigned int round;
+	int opt, fd, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d directory] [-n entries]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (statfs(base, &sfs)) {
+		printf("%s: %s, skipping\n", base, strerror(errno));
+		return 0;
+	}
+	if (sfs.f_type != SDCARDFS_SUPER_MAGIC) {
+		printf("%s is not on sdcardfs, skipping\n", base);
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/ci_lookup_bench.%d", base, getpid());
+	if (mkdir(dir, 0775)) {
+		printf("%s: %s, skipping\n", dir, strerror(errno));
+		return 0;
+	}
+	for (i = 0; i < entries; i++) {
+		name(path, sizeof(path), PREFIX, 0, i);
+		fd = open(path, O_CREAT | O_WRONLY, 0664);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			cleanup();
+			return 1;
+		}
+		close(fd);
+	}
+
+	printf("%d entries, usecs per stat()\n", entries);
+	printf("%-6s %12s %12s %12s\n", "round", "exact", "wrong case",
+	       "missing");
+	for (round = 1; round <= ROUNDS; round++) {
+		double exact, wrong, absent;
+
+		snprintf(missing, sizeof(missing), "absent%u_", round);
+		exact = time_stats(PREFIX, 0, 0);
+		wrong = time_stats(PREFIX, round, 0);
+		absent = time_stats(missing, 0, ENOENT);
+		if (exact < 0 || wrong < 0 || absent < 0) {
+			ret = 1;
+			break;
+		}
+		printf("%-6u %12.2f %12.2f %12.2f\n", round, exact, wrong,
+		       absent);
+	}
+
+	cleanup();
+	return ret;
+}
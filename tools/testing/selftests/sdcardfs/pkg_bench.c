@@ -0,0 +1,194 @@
+/*
+ * sdcardfs package change benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Fills the dcache of an sdcardfs mount with many entries, then times
+ * package installs through the sdcardfs configfs interface, i.e. writes
+ * to <configfs>/sdcardfs/<package>/appid, and the stat() sweep over the
+ * cached entries right after each install, which is where the derived
+ * permissions are revalidated against the new package list.  A sweep
+ * without a package change in between is timed for reference.
+ *
+ * usage: pkg_bench [-d directory on sdcardfs] [-c configfs sdcardfs dir]
+ *                  [-n entries] [-i installs]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SDCARDFS_SUPER_MAGIC	0xb550ca10
+#define PER_DIR			1000
+
+static char dir[4096];
+static int entries = 100000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void entry_path(char *buf, size_t size, int i)
+{
+	if (i < 0)
+		snprintf(buf, size, "%s/d%03d", dir, -i - 1);
+	else
+		snprintf(buf, size, "%s/d%03d/f%06d", dir, i / PER_DIR, i);
+}
+
+static int populate(void)
+{
+	char path[4200];
+	int i, fd;
+
+	for (i = 0; i < entries; i++) {
+		if (i % PER_DIR == 0) {
+			entry_path(path, sizeof(path), -(i / PER_DIR) - 1);
+			if (mkdir(path, 0775))
+				goto err;
+		}
+		entry_path(path, sizeof(path), i);
+		fd = open(path, O_CREAT | O_WRONLY, 0664);
+		if (fd < 0)
+			goto err;
+		close(fd);
+	}
+	return 0;
+err:
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+static double sweep(void)
+{
+	char path[4200];
+	struct stat st;
+	double start = now();
+	int i;
+
+	for (i = 0; i < entries; i++) {
+		entry_path(path, sizeof(path), i);
+		stat(path, &st);
+	}
+	return (now() - start) * 1e3;
+}
+
+static void cleanup(void)
+{
+	char path[4200];
+	int i;
+
+	for (i = 0; i < entries; i++) {
+		entry_path(path, sizeof(path), i);
+		unlink(path);
+	}
+	for (i = 0; i < (entries + PER_DIR - 1) / PER_DIR; i++) {
+		entry_path(path, sizeof(path), -i - 1);
+		rmdir(path);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+	const char *base = "/sdcard";
+	const char *config = "/config/sdcardfs";
+	char pkg[4096], appid[4200], val[16];
+	struct statfs sfs;
+	int opt, fd, len, i, installs = 10, ret = 0;
+	double start, write_us;
+
+	while ((opt = getopt(argc, argv, "d:c:n:i:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 'c':
+			config = optarg;
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		case 'i':
+			installs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d directory] [-c configfs dir] [-n entries] [-i installs]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (statfs(base, &sfs)) {
+		printf("%s: %s, skipping\n", base, strerror(errno));
+		return 0;
+	}
+	if (sfs.f_type != SDCARDFS_SUPER_MAGIC) {
+		printf("%s is not on sdcardfs, skipping\n", base);
+		return 0;
+	}
+	if (access(config, W_OK)) {
+		printf("%s: %s, skipping\n", config, strerror(errno));
+		return 0;
+	}
+
+	snprintf(pkg, sizeof(pkg), "%s/com.example.pkg_bench%d", config,
+		 getpid());
+	if (mkdir(pkg, 0755)) {
+		printf("%s: %s, skipping\n", pkg, strerror(errno));
+		return 0;
+	}
+	snprintf(appid, sizeof(appid), "%s/appid", pkg);
+
+	snprintf(dir, sizeof(dir), "%s/pkg_bench.%d", base, getpid());
+	if (mkdir(dir, 0775)) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		rmdir(pkg);
+		return 1;
+	}
+	if (populate()) {
+		ret = 1;
+		goto out;
+	}
+	sweep();
+
+	printf("%d cached entries\n", entries);
+	printf("%-8s %12s %16s\n", "install", "write (us)", "sweep (ms)");
+	printf("%-8s %12s %16.2f\n", "none", "-", sweep());
+	for (i = 0; i < installs; i++) {
+		/* alternate the appid, so each write is a real change */
+		len = snprintf(val, sizeof(val), "%d\n", 50000 + i % 2);
+		fd = open(appid, O_WRONLY);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", appid, strerror(errno));
+			ret = 1;
+			break;
+		}
+		start = now();
+		if (write(fd, val, len) != len) {
+			fprintf(stderr, "%s: %s\n", appid, strerror(errno));
+			close(fd);
+			ret = 1;
+			break;
+		}
+		write_us = (now() - start) * 1e6;
+		close(fd);
+		printf("%-8d %12.1f %16.2f\n", i + 1, write_us, sweep());
+	}
+
+out:
+	cleanup();
+	rmdir(pkg);
+	return ret;
+}
@@ -0,0 +1,124 @@
+/*
+ * Swap writeout benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Allocates more anonymous memory than fits in RAM and dirties all of it
+ * pass after pass, so that reclaim keeps writing anon pages out to swap
+ * while they are faulted back in.  For each pass, reports the rate at
+ * which pages were dirtied and the pswpout/pswpin rates from /proc/vmstat.
+ *
+ * usage: swapout_bench [-m MB to allocate] [-p passes]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* value of 'key' in a "key value" or "key: value kB" file, -1 if absent */
+static long read_field(const char *file, const char *key)
+{
+	char line[256];
+	size_t len = strlen(key);
+	long val = -1;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, key, len) &&
+		    (line[len] == ' ' || line[len] == ':')) {
+			val = strtol(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return val;
+}
+
+int main(int argc, char **argv)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	long mem_mb, swap_mb, size_mb = 0;
+	long out0, in0, out1, in1;
+	size_t size, off;
+	int opt, pass, passes = 4;
+	double start, secs;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "m:p:")) != -1) {
+		switch (opt) {
+		case 'm':
+			size_mb = atol(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m MB] [-p passes]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	mem_mb = read_field("/proc/meminfo", "MemTotal") / 1024;
+	swap_mb = read_field("/proc/meminfo", "SwapFree") / 1024;
+	if (mem_mb <= 0 || read_field("/proc/vmstat", "pswpout") < 0) {
+		printf("no /proc/meminfo or /proc/vmstat, skipping\n");
+		return 0;
+	}
+	if (swap_mb <= 0) {
+		printf("no free swap, skipping\n");
+		return 0;
+	}
+	/* overcommit RAM by half the free swap, but by no more than half */
+	if (!size_mb)
+		size_mb = mem_mb + (swap_mb < mem_mb ? swap_mb : mem_mb) / 2;
+	if (size_mb >= mem_mb + swap_mb) {
+		printf("%ld MB does not fit in RAM and free swap, skipping\n",
+		       size_mb);
+		return 0;
+	}
+
+	size = (size_t)size_mb << 20;
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		printf("mmap %ld MB: %s, skipping\n", size_mb, strerror(errno));
+		return 0;
+	}
+
+	printf("%ld MB anon, %ld MB RAM, %ld MB free swap\n", size_mb, mem_mb,
+	       swap_mb);
+	printf("%-5s %10s %12s %12s %12s\n", "pass", "secs", "pages/s",
+	       "pswpout/s", "pswpin/s");
+	for (pass = 1; pass <= passes; pass++) {
+		out0 = read_field("/proc/vmstat", "pswpout");
+		in0 = read_field("/proc/vmstat", "pswpin");
+		start = now();
+		for (off = 0; off < size; off += page_size)
+			buf[off] = pass;
+		secs = now() - start;
+		out1 = read_field("/proc/vmstat", "pswpout");
+		in1 = read_field("/proc/vmstat", "pswpin");
+		printf("%-5d %10.2f %12.0f %12.0f %12.0f\n", pass, secs,
+		       size / page_size / secs, (out1 - out0) / secs,
+		       (in1 - in0) / secs);
+	}
+
+	munmap(buf, size);
+	return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * zram write scaling benchmark
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ *
+ * Writes a disjoint region of an initialized zram device from 1, 2, 4, ...
+ * threads with O_DIRECT and reports the aggregate write and read
+ * throughput for each thread count. With one compression stream per
+ * writer, throughput should scale with the number of cores until
+ * max_comp_streams is reached.
+ *
+ * The device must already have a disksize of at least
+ * threads * size; the data written is lost.
+ *
+ * usage: zram_bench [-d device] [-t max threads] [-s MiB per thread]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SZ		4096
+#define CHUNK		(64 * PAGE_SZ)
+
+static const char *device = "/dev/zram0";
+static int fd;
+static size_t region;		/* bytes written by each thread */
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int write;
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Half of each page is pseudo random and half a repeated byte, so pages
+ * compress to roughly 50% and no two pages are identical or same-filled.
+ */
+static void fill_chunk(unsigned char *buf, uint64_t seed)
+{
+	uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+	size_t off, i;
+
+	for (off = 0; off < CHUNK; off += PAGE_SZ) {
+		for (i = 0; i < PAGE_SZ / 2; i += sizeof(x)) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			memcpy(buf + off + i, &x, sizeof(x));
+		}
+		memset(buf + off + PAGE_SZ / 2, (int)(x & 0xff), PAGE_SZ / 2);
+	}
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	off_t base = (off_t)w->id * region;
+	unsigned char *buf;
+	size_t done;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, CHUNK)) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+
+	for (done = 0; done < region; done += CHUNK) {
+		ssize_t ret;
+
+		if (w->write) {
+			fill_chunk(buf, base + done);
+			ret = pwrite(fd, buf, CHUNK, base + done);
+		} else {
+			ret = pread(fd, buf, CHUNK, base + done);
+		}
+		if (ret != CHUNK) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int run(int nr_threads, int write, double *mbps)
+{
+	struct worker *workers;
+	double start, elapsed;
+	int i, err = 0;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return ENOMEM;
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		workers[i].write = write;
+		pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err)
+			err = workers[i].err;
+	}
+	elapsed = now() - start;
+
+	free(workers);
+	*mbps = (double)nr_threads * region / elapsed / (1 << 20);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long mib = 64;
+	uint64_t disksize;
+	int opt, nr;
+
+	while ((opt = getopt(argc, argv, "d:t:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			mib = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d device] [-t threads] [-s MiB]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1)
+		max_threads = 1;
+	region = (mib << 20) / CHUNK * CHUNK;
+
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		printf("%s: %s, skipping\n", device, strerror(errno));
+		return 0;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &disksize) || !disksize) {
+		printf("%s is not initialized, skipping\n", device);
+		return 0;
+	}
+	if (disksize < (uint64_t)max_threads * region) {
+		printf("%s: disksize %llu too small for %d x %lu MiB, skipping\n",
+		       device, (unsigned long long)disksize, max_threads, mib);
+		return 0;
+	}
+
+	printf("%-8s %12s %12s\n", "threads", "write MB/s", "read MB/s");
+	for (nr = 1; ; nr *= 2) {
+		double wr, rd;
+		int err;
+
+		if (nr > max_threads)
+			nr = max_threads;
+
+		err = run(nr, 1, &wr);
+		if (!err)
+			err = run(nr, 0, &rd);
+		if (err) {
+			printf("%d threads: %s\n", nr, strerror(err));
+			return 1;
+		}
+		printf("%-8d %12.1f %12.1f\n", nr, wr, rd);
+		if (nr == max_threads)
+			break;
+	}
+
+	close(fd);
+	return 0;
+}